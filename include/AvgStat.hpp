@@ -2,10 +2,19 @@
 
 #include "Types.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
 #include <nlohmann/json_fwd.hpp>
+#include <span>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+/* How many variables the v2 recommendation algorithm has */
+constexpr u8 v2_variable_count = 8;
+
 namespace stats
 {
 	enum class recommendation_algorithm
@@ -14,60 +23,296 @@ namespace stats
 		v2 = 1
 	};
 
+	/* How many of the latest profits are kept around for each item */
+	constexpr u8 recent_profit_window_size = 15;
+
+	/* Running totals of the flips done with a single item. These are stored
+	 * in the database and updated as flips get sold or cancelled, so the
+	 * per-item stats don't need to be recalculated from all of the flips */
+	struct item_aggregate
+	{
+		i64 total_profit = 0;
+		i64 total_item_count = 0;
+		i64 min_profit = 0;
+		i64 max_profit = 0;
+
+		/* Running mean and sum of squared differences from the mean of the
+		 * profits (Welford's algorithm). Stays accurate with large profits
+		 * unlike a plain sum of squares */
+		f64 profit_mean = 0;
+		f64 profit_m2 = 0;
+
+		f64 total_roi = 0;
+		u32 flip_count = 0;
+		u32 profitable_flip_count = 0;
+		u32 cancelled_flip_count = 0;
+		u32 latest_trade_index = 0;
+		u32 recent_count = 0;
+
+		/* Profits of the flips with the largest trade indices in trade index order.
+		 * The profits are kept as 64-bit values like the totals, so a single
+		 * big flip doesn't get truncated */
+		std::array<u32, recent_profit_window_size> recent_trade_indices{};
+		std::array<i64, recent_profit_window_size> recent_profits{};
+
+		void add_flip(const i64 profit, const f64 ROI, const u32 item_count, const u32 trade_index);
+		void add_cancel();
+	};
+
+	static_assert(std::is_trivially_copyable_v<item_aggregate>);
+	static_assert(sizeof(item_aggregate) == 256, "item_aggregate is stored as-is in the database");
+
+	struct scoring_context;
+	class avg_stat_table;
+
 	class avg_stat
 	{
 	public:
 		avg_stat();
 		explicit avg_stat(const std::string& item_name);
+		avg_stat(const std::string& item_name, const item_aggregate& aggregate);
 		void add_data(const i64 profit, const f64 ROI, const u32 item_count, const u32 latest_trade_index = 0);
 		void inc_cancel_count();
 		f64 avg_profit() const;
-		f64 normalized_avg_profit() const;
+		f64 normalized_avg_profit(const scoring_context& context) const;
 		f64 profit_standard_deviation() const;
+		i64 min_profit() const;
+		i64 max_profit() const;
 		f64 rolling_avg_profit(const u32 window_size) const; /* Get the avg. profit of the latest flips */
 		f64 avg_roi() const;
-		f64 normalized_avg_roi() const;
+		f64 normalized_avg_roi(const scoring_context& context) const;
 		f64 avg_buy_limit() const;
-		f64 normalized_avg_buy_limit() const;
-		f64 flip_recommendation() const;
+		f64 normalized_avg_buy_limit(const scoring_context& context) const;
+		f64 flip_recommendation(const scoring_context& context) const;
 		u32 flip_count() const;
 		u32 profitable_flip_count() const;
 		u32 cancelled_flip_count() const;
 		f64 cancellation_ratio() const;
 		i32 latest_trade_index() const;
-		const std::vector<i32>& profits() const;
+		std::span<const i64> profits() const; /* Profits of the latest flips, up to recent_profit_window_size of them */
+		u32 recent_profit_count() const; /* How many of the latest profits are known */
+		i64 recent_profit(const u32 age) const; /* Profit of the latest flip with age 0, the one before it with age 1 etc. */
+
+		std::string name;
 
-		// how many flips have been done in total
-		static u32 total_flip_count();
+	private:
+		item_aggregate aggregate;
 
-		static void set_recommendation_algorithm(const u8 algorithm);
+		/* Totals of the latest profits. Index n has the sum of the latest n
+		 * profits, so rolling averages don't need to add anything up */
+		std::array<i64, recent_profit_window_size + 1> recent_profit_sums{};
+		void update_recent_profit_sums();
 
-		std::string name;
+		friend class avg_stat_table;
+	};
+
+	/* Stats of many items stored column by column. Scoring and sorting only
+	 * touch the columns they need and the recent profits of all of the items
+	 * share a single buffer, so there are no per-item allocations besides the names */
+	class avg_stat_table
+	{
+	public:
+		/* A single item in the table. Has the same getters as avg_stat,
+		 * so the recommendation algorithms work with both of them */
+		class row
+		{
+		public:
+			row(const avg_stat_table& table, const u32 index);
+			const std::string& name() const;
+			f64 avg_profit() const;
+			f64 normalized_avg_profit(const scoring_context& context) const;
+			f64 profit_standard_deviation() const;
+			f64 rolling_avg_profit(const u32 window_size) const;
+			f64 avg_roi() const;
+			f64 normalized_avg_roi(const scoring_context& context) const;
+			f64 avg_buy_limit() const;
+			f64 normalized_avg_buy_limit(const scoring_context& context) const;
+			f64 flip_recommendation(const scoring_context& context) const;
+			u32 flip_count() const;
+			u32 profitable_flip_count() const;
+			u32 cancelled_flip_count() const;
+			f64 cancellation_ratio() const;
+			i32 latest_trade_index() const;
+			std::span<const i64> profits() const;
+			u32 recent_profit_count() const;
+			i64 recent_profit(const u32 age) const;
+
+		private:
+			const avg_stat_table& table;
+			const u32 index;
+		};
+
+		avg_stat_table() = default;
+		explicit avg_stat_table(const std::vector<avg_stat>& stats);
+
+		void reserve(const size_t item_count);
+		void add(const std::string& name, const item_aggregate& aggregate);
+
+		/* A new table with the items at the given indices in the same order */
+		__attribute__((warn_unused_result))
+		avg_stat_table subset(const std::vector<u32>& indices) const;
+
+		size_t size() const;
+		bool empty() const;
+		row operator[](const u32 index) const;
+
+	private:
+		std::vector<std::string> names;
+		std::vector<i64> total_profits;
+		std::vector<i64> total_item_counts;
+		std::vector<f64> total_rois;
+		std::vector<f64> profit_m2s;
+		std::vector<u32> flip_counts;
+		std::vector<u32> profitable_flip_counts;
+		std::vector<u32> cancelled_flip_counts;
+		std::vector<u32> latest_trade_indices;
+
+		/* Recent profits of the item i from the oldest to the latest are
+		 * in recent_profits[profit_offsets[i]] .. recent_profits[profit_offsets[i + 1] - 1] */
+		std::vector<i64> recent_profits;
+		std::vector<u32> profit_offsets{0};
+
+		/* Running totals of the recent profits. The item i has one more of them than
+		 * recent profits starting from profit_offsets[i] + i, the first one being zero */
+		std::vector<i64> recent_profit_totals;
+	};
+
+	/* Everything that the recommendation scores depend on besides the item
+	 * itself. Each set of item stats gets its own context, so different sets
+	 * can be scored at the same time without sharing any state */
+	struct scoring_context
+	{
+		/* The default algorithm and weights with empty value ranges */
+		scoring_context();
+
+		/* Value ranges and the flip count of the given items */
+		explicit scoring_context(const std::vector<avg_stat>& stats);
+		explicit scoring_context(const avg_stat_table& stats);
+
+		/* Pick the algorithm by its version number */
+		void set_algorithm(const u8 version);
+
+		recommendation_algorithm algorithm = recommendation_algorithm::v2;
+
+		/* Weights of the v2 algorithm */
+		std::array<f64, v2_variable_count> weights;
 
 		// range of average profits
-		static inline f64 min_avg_profit{0};
-		static inline f64 max_avg_profit{0};
+		f64 min_avg_profit{0};
+		f64 max_avg_profit{0};
 
 		// range of average buy limits
-		static inline f64 min_avg_buy_limit{0};
-		static inline f64 max_avg_buy_limit{0};
+		f64 min_avg_buy_limit{0};
+		f64 max_avg_buy_limit{0};
 
 		// range of ROI-%
-		static inline f64 min_avg_roi{0};
-		static inline f64 max_avg_roi{0};
+		f64 min_avg_roi{0};
+		f64 max_avg_roi{0};
 
-	private:
-		std::vector<i32> profit_list;
+		// how many flips have been done in total (the latest trade index of the items)
+		u32 total_flip_count{0};
+	};
 
-		i64 total_profit = 0;
-		f64 total_roi = 0;
-		i32 total_item_count = 0;
-		u32 _latest_trade_index = 0;
-		u32 _cancelled_flip_count = 0;
+	/* The getters used by the recommendation algorithms are defined here, so that
+	 * they can be inlined into the scoring loops */
+	inline size_t avg_stat_table::size() const
+	{
+		return names.size();
+	}
 
-		// the total amount (count) of flip data added to avgstats
-		static inline u32 _total_flip_count{0};
-	};
+	inline bool avg_stat_table::empty() const
+	{
+		return names.empty();
+	}
+
+	inline avg_stat_table::row avg_stat_table::operator[](const u32 index) const
+	{
+		return row(*this, index);
+	}
+
+	inline avg_stat_table::row::row(const avg_stat_table& table, const u32 index)
+	:table(table), index(index)
+	{
+		assert(index < table.size());
+	}
+
+	inline f64 avg_stat_table::row::avg_profit() const
+	{
+		return flip_count() == 0 ? 0 : table.total_profits[index] / static_cast<f64>(flip_count());
+	}
+
+	inline f64 avg_stat_table::row::normalized_avg_profit(const scoring_context& context) const
+	{
+		return (avg_profit() - context.min_avg_profit) / (context.max_avg_profit - context.min_avg_profit);
+	}
+
+	inline f64 avg_stat_table::row::profit_standard_deviation() const
+	{
+		assert(flip_count() != 0);
+		return std::sqrt(table.profit_m2s[index] / flip_count());
+	}
+
+	inline f64 avg_stat_table::row::rolling_avg_profit(const u32 window_size) const
+	{
+		assert(window_size <= recent_profit_window_size);
+
+		const u32 rolling_profit_count = std::min(window_size, recent_profit_count());
+		if (rolling_profit_count == 0)
+			return 0;
+
+		const i64* totals = &table.recent_profit_totals[table.profit_offsets[index] + index];
+		const i64 rolling_total_profit = totals[recent_profit_count()] - totals[recent_profit_count() - rolling_profit_count];
+
+		return rolling_total_profit / static_cast<double>(rolling_profit_count);
+	}
 
-	std::vector<avg_stat> flips_to_avg_stats(const std::vector<nlohmann::json>& flips);
+	inline f64 avg_stat_table::row::avg_roi() const
+	{
+		return flip_count() == 0 ? 0 : table.total_rois[index] / static_cast<f64>(flip_count());
+	}
+
+	inline f64 avg_stat_table::row::normalized_avg_roi(const scoring_context& context) const
+	{
+		return (avg_roi() - context.min_avg_roi) / (context.max_avg_roi - context.min_avg_roi);
+	}
+
+	inline f64 avg_stat_table::row::avg_buy_limit() const
+	{
+		return flip_count() == 0 ? 0 : table.total_item_counts[index] / static_cast<f64>(flip_count());
+	}
+
+	inline f64 avg_stat_table::row::normalized_avg_buy_limit(const scoring_context& context) const
+	{
+		return (avg_buy_limit() - context.min_avg_buy_limit) / (context.max_avg_buy_limit - context.min_avg_buy_limit);
+	}
+
+	inline u32 avg_stat_table::row::flip_count() const
+	{
+		return table.flip_counts[index];
+	}
+
+	inline u32 avg_stat_table::row::profitable_flip_count() const
+	{
+		return table.profitable_flip_counts[index];
+	}
+
+	inline u32 avg_stat_table::row::cancelled_flip_count() const
+	{
+		return table.cancelled_flip_counts[index];
+	}
+
+	inline f64 avg_stat_table::row::cancellation_ratio() const
+	{
+		return cancelled_flip_count() / static_cast<f64>(cancelled_flip_count() + flip_count());
+	}
+
+	inline i32 avg_stat_table::row::latest_trade_index() const
+	{
+		return table.latest_trade_indices[index];
+	}
+
+	inline u32 avg_stat_table::row::recent_profit_count() const
+	{
+		return table.profit_offsets[index + 1] - table.profit_offsets[index];
+	}
 }
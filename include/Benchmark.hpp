@@ -0,0 +1,9 @@
+#pragma once
+
+namespace benchmark
+{
+	/* Measure the performance critical parts of the program with generated
+	 * data, so that the results don't depend on the contents of the database */
+	__attribute__((cold))
+	void run();
+}
@@ -1,11 +1,18 @@
 #pragma once
 
 #include "AvgStat.hpp"
+#include "FlipStore.hpp"
+#include "OpLog.hpp"
 #include "Types.hpp"
 
 #include <algorithm>
+#include <cassert>
 #include <nlohmann/json.hpp>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace flips
@@ -32,62 +39,160 @@ public:
 		flips_done, profit
 	};
 
+	/* Value type of each flip field */
+	template<flip_key key>
+	using flip_type = std::conditional_t<key == flip_key::account || key == flip_key::item, std::string,
+		  std::conditional_t<key == flip_key::cancelled || key == flip_key::done, bool, i32>>;
+
 	void add_flip(const flips::flip& flip); /* Add a new flip */
 
+	/* Add a new flip without logging it. The next write() rewrites the whole
+	 * data file instead, which is a lot faster than a log record per flip
+	 * when importing a large amount of flips */
+	void import_flip(const flips::flip& flip);
+
 	size_t total_flip_count() const; /* Total amount of flips (done and not done) */
 
 	template<typename T>
 	__attribute__((hot, warn_unused_result))
 	T get_flip(const u32 index, const flip_key key) const
 	{
-		return json_data["flips"][index].at(flip_key_to_str.at(key));
+		assert(index < total_flip_count());
+
+		if constexpr (std::is_same_v<T, std::string>)
+			return get_flip_str(index, key);
+		else
+			return static_cast<T>(get_flip_num(index, key));
 	}
 
-	template<typename T>
+	/* Compile-time field access. The key resolves directly to its column */
+	template<flip_key key>
+	__attribute__((hot, warn_unused_result))
+	std::conditional_t<std::is_same_v<flip_type<key>, std::string>, const std::string&, flip_type<key>> get_flip(const u32 index) const
+	{
+		assert(index < total_flip_count());
+
+		if constexpr (key == flip_key::account)
+			return store.accounts.at(store.account[index]);
+		else if constexpr (key == flip_key::item)
+			return store.items.at(store.item[index]);
+		else if constexpr (std::is_same_v<flip_type<key>, bool>)
+			return column<key>(store)[index] != 0;
+		else
+			return column<key>(store)[index];
+	}
+
+	template<flip_key key>
+	__attribute__((hot))
+	void set_flip(const u32 index, const flip_type<key>& data)
+	{
+		assert(index < total_flip_count());
+
+		if constexpr (key == flip_key::account)
+			store.account[index] = store.accounts.intern(data);
+		else if constexpr (key == flip_key::item)
+			change_flip_item(index, store.items.intern(data));
+		else
+			column<key>(store)[index] = data;
+
+		if constexpr (key == flip_key::done || key == flip_key::cancelled)
+			update_open_flip(index);
+
+		if (operation_log)
+			log_flip_change(index, key, data);
+	}
+
+	template<flip_key key>
 	__attribute__((warn_unused_result))
-	f64 get_flip_average(const std::vector<u32>& indices, const flip_key key) const
+	f64 get_flip_average(const std::vector<u32>& indices) const
 	{
-		T total = std::accumulate(indices.begin(), indices.end(), 0, [&](T total, u32 flip_index){
-			const T json_value = json_data["flips"][flip_index].at(flip_key_to_str.at(key));
-			return json_value + total;
+		const i64 total = std::accumulate(indices.begin(), indices.end(), i64{0}, [&](i64 total, u32 flip_index){
+			return get_flip<key>(flip_index) + total;
 		});
 
 		return total / static_cast<f64>(indices.size());
 	}
 
-	template<typename T>
+	template<flip_key key>
 	__attribute__((warn_unused_result))
-	T get_flip_min(const std::vector<u32>& indices, const flip_key key) const
+	flip_type<key> get_flip_min(const std::vector<u32>& indices) const
 	{
-		std::vector<T> values = get_flip_values<T>(indices, key);
-		return *std::min_element(values.begin(), values.end());
+		assert(!indices.empty());
+		const u32 min_index = *std::min_element(indices.begin(), indices.end(), [&](const u32 a, const u32 b) {
+			return get_flip<key>(a) < get_flip<key>(b);
+		});
+
+		return get_flip<key>(min_index);
 	}
 
-	template<typename T>
+	template<flip_key key>
 	__attribute__((warn_unused_result))
-	T get_flip_max(const std::vector<u32>& indices, const flip_key key) const
+	flip_type<key> get_flip_max(const std::vector<u32>& indices) const
 	{
-		std::vector<T> values = get_flip_values<T>(indices, key);
-		return *std::max_element(values.begin(), values.end());
+		assert(!indices.empty());
+		const u32 max_index = *std::max_element(indices.begin(), indices.end(), [&](const u32 a, const u32 b) {
+			return get_flip<key>(a) < get_flip<key>(b);
+		});
+
+		return get_flip<key>(max_index);
 	}
 
+	/* Runtime field access for when the key isn't known at compile time */
 	template<typename T>
 	__attribute__((hot))
 	void set_flip(const u32 index, const flip_key key, const T data)
 	{
-		assert(index < json_data["flips"].size());
-		json_data["flips"][index][flip_key_to_str.at(key)] = data;
+		assert(index < total_flip_count());
+
+		if constexpr (std::is_convertible_v<T, std::string>)
+		{
+			store_flip_str(index, key, data);
+			if (operation_log)
+				log_flip_change(index, key, std::string(data));
+		}
+		else
+		{
+			store_flip_num(index, key, data);
+			if (operation_log)
+				log_flip_change(index, key, static_cast<i64>(data));
+		}
 	}
 
 	__attribute__((warn_unused_result))
 	flips::flip get_flip_obj(const u32 index) const;
 
+	/* Indices of the flips that are neither done nor cancelled in the
+	 * order they were added. The position in this list is the flip ID
+	 * shown by the list command */
+	__attribute__((warn_unused_result))
+	const std::vector<u32>& open_flip_indices() const;
+
+	/* Stats of every item that has been flipped at least once. Built from
+	 * the stored per-item aggregates */
 	__attribute__((warn_unused_result))
 	std::vector<stats::avg_stat> get_flip_avg_stats() const;
 
+	/* The same stats stored column by column */
+	__attribute__((warn_unused_result))
+	stats::avg_stat_table get_flip_stat_table() const;
+
+	/* Count a flip that was just sold or cancelled into the stats of its item */
+	void add_to_item_stats(const u32 index);
+
+	/* Recalculate the per-item stats from scratch. Needed after flips
+	 * that were already counted have been modified */
+	void rebuild_item_stats();
+
+	/* Finished flips of an item. The name is case-insensitive */
 	__attribute__((warn_unused_result))
 	std::vector<u32> find_flips_by_name(const std::string& item_name) const;
 
+	/* Item names that start with or contain the query (case-insensitive).
+	 * Names that start with the query are listed first */
+	__attribute__((warn_unused_result))
+	std::vector<std::string> search_items(const std::string& query) const;
+
+	/* The latest finished flip of each item that has been flipped at most flip_count times */
 	__attribute__((warn_unused_result))
 	std::vector<u32> find_flips_by_count(const u32 flip_count) const;
 
@@ -95,41 +200,120 @@ public:
 	i64 get_stat(const stat_key key) const;
 	void set_stat(const stat_key key, const i64 data);
 
-	void write(); /* Write the DB to disk */
+	/* Commit the changes made since the last write to the operation log.
+	 * Once the log grows large enough it gets checkpointed into the data file */
+	void write();
+
+	__attribute__((warn_unused_result))
+	nlohmann::json to_json() const; /* The database in the legacy json format */
 
 private:
-	nlohmann::json json_data;
+	flip_store::columns store;
 
-	bool validate(const nlohmann::json& json_obj); /* Make sure that everything is OK with the DB file */
+	/* Sorted indices of on-going flips */
+	std::vector<u32> open_flips;
 
-	template<typename T>
-	__attribute__((warn_unused_result))
-	std::vector<T> get_flip_values(const std::vector<u32>& indices, const flip_key key) const
+	/* Indices of all flips of an item, sorted and indexed by the item id */
+	std::vector<std::vector<u32>> item_flips;
+
+	/* Lowercase item names sorted alphabetically and the ids of the items with that name.
+	 * The same item could've been written with different casing */
+	std::vector<std::pair<std::string, std::vector<u32>>> item_names;
+
+	/* Only databases backed by the data file have an operation log */
+	std::optional<op_log> operation_log;
+
+	/* Set when there are changes that only a checkpoint can write */
+	bool checkpoint_needed = false;
+
+	enum class log_op : u8
 	{
-		std::vector<T> values;
-		std::transform(indices.begin(), indices.end(), std::back_inserter(values), [&](const u32 index)
+		add_flip, set_flip_num, set_flip_str, set_stat, add_to_item_stats, rebuild_item_stats
+	};
+
+	bool validate(const nlohmann::json& json_obj); /* Make sure that everything is OK with the legacy json file */
+
+	void load_json(const nlohmann::json& json_obj);
+	void migrate_json_data_file(); /* Convert the legacy json database into the binary format */
+
+	void checkpoint(); /* Rewrite the data file and empty the operation log */
+	bool replay(const std::string& record); /* Apply an operation log record */
+
+	void store_flip(const flips::flip& flip);
+
+	void aggregate_flip(const u32 index); /* Add a finished or cancelled flip to the stats of its item */
+	void aggregate_flip(const u32 index, stats::item_aggregate& aggregate) const;
+	void calculate_item_stats();
+
+	void rebuild_indices();
+	void update_open_flip(const u32 index); /* Call after the done or cancelled state of a flip changes */
+	void index_item_flip(const u32 index); /* Add a flip to the index of its item */
+	void change_flip_item(const u32 index, const u32 item_id);
+	const std::vector<u32>* find_item_ids(const std::string& item_name_lowercase) const;
+	void log_flip_change(const u32 index, const flip_key key, const i64 data);
+	void log_flip_change(const u32 index, const flip_key key, const std::string& data);
+
+	/* Map a flip key to its column. Works with both const and non-const columns */
+	template<flip_key key, typename columns>
+	static auto& column(columns& data)
+	{
+		if constexpr (key == flip_key::account)			return data.account;
+		else if constexpr (key == flip_key::item)		return data.item;
+		else if constexpr (key == flip_key::buy)		return data.buy;
+		else if constexpr (key == flip_key::sell)		return data.sell;
+		else if constexpr (key == flip_key::sold)		return data.sold;
+		else if constexpr (key == flip_key::limit)		return data.limit;
+		else if constexpr (key == flip_key::cancelled)	return data.cancelled;
+		else if constexpr (key == flip_key::done)		return data.done;
+	}
+
+	__attribute__((hot))
+	const std::string& get_flip_str(const u32 index, const flip_key key) const
+	{
+		switch (key)
 		{
-			return json_data["flips"][index].at(flip_key_to_str.at(key));
-		});
+			case flip_key::account:	return store.accounts.at(store.account[index]);
+			case flip_key::item:	return store.items.at(store.item[index]);
+			default:				throw std::invalid_argument("flip key is not a string value");
+		}
+	}
 
-		return values;
+	__attribute__((hot))
+	i64 get_flip_num(const u32 index, const flip_key key) const
+	{
+		switch (key)
+		{
+			case flip_key::buy:			return store.buy[index];
+			case flip_key::sell:		return store.sell[index];
+			case flip_key::sold:		return store.sold[index];
+			case flip_key::limit:		return store.limit[index];
+			case flip_key::cancelled:	return store.cancelled[index];
+			case flip_key::done:		return store.done[index];
+			default:					throw std::invalid_argument("flip key is not a numeric value");
+		}
 	}
 
-	void create_default_data_file();
-
-	const static inline std::unordered_map<flip_key, std::string> flip_key_to_str = {
-		{ flip_key::account,	"account" },
-		{ flip_key::item,		"item" },
-		{ flip_key::buy,		"buy" },
-		{ flip_key::sell,		"sell" },
-		{ flip_key::sold,		"sold" },
-		{ flip_key::limit,		"limit" },
-		{ flip_key::cancelled,	"cancelled" },
-		{ flip_key::done,		"done" },
-	};
+	void store_flip_str(const u32 index, const flip_key key, const std::string& data)
+	{
+		switch (key)
+		{
+			case flip_key::account:	store.account[index] = store.accounts.intern(data); break;
+			case flip_key::item:	change_flip_item(index, store.items.intern(data)); break;
+			default:				throw std::invalid_argument("flip key is not a string value");
+		}
+	}
 
-	const static inline std::unordered_map<stat_key, std::string> stat_key_to_str = {
-		{ stat_key::flips_done,	"flips_done" },
-		{ stat_key::profit,		"profit" },
-	};
+	void store_flip_num(const u32 index, const flip_key key, const i64 data)
+	{
+		switch (key)
+		{
+			case flip_key::buy:			store.buy[index] = data; break;
+			case flip_key::sell:		store.sell[index] = data; break;
+			case flip_key::sold:		store.sold[index] = data; break;
+			case flip_key::limit:		store.limit[index] = data; break;
+			case flip_key::cancelled:	store.cancelled[index] = data != 0; update_open_flip(index); break;
+			case flip_key::done:		store.done[index] = data != 0; update_open_flip(index); break;
+			default:					throw std::invalid_argument("flip key is not a numeric value");
+		}
+	}
 };
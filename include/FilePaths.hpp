@@ -6,6 +6,11 @@ namespace file_paths
 {
 	static inline const std::string user_home = (std::string)getenv("HOME");
 	static inline const std::string data_path = user_home + "/.local/share/rs-flip";
-	static inline const std::string data_file = data_path + "/flips.json";
+	static inline const std::string data_file = data_path + "/flips.db";
+	static inline const std::string op_log_file = data_path + "/flips.log";
+	static inline const std::string legacy_data_file = data_path + "/flips.json";
 	static inline const std::string item_blacklist_file = data_path + "/item_blacklist.txt";
+	static inline const std::string optimizer_checkpoint_file = data_path + "/optimizer_checkpoint.json";
+	static inline const std::string v2_weights_file = data_path + "/v2_weights.json";
+	static inline const std::string server_socket_file = data_path + "/flip.sock";
 }
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "AvgStat.hpp"
+#include "Types.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Binary column oriented storage for the flip database
+ *
+ * File layout (native little-endian):
+ *   header     magic, format version, flip count, dictionary sizes, stats, generation, payload checksum
+ *   dictionary item names followed by account names (u32 length + bytes each)
+ *   columns    one array per db::flip_key in declaration order
+ *   aggregates one stats::item_aggregate per item in item id order
+ *
+ * Item and account names are dictionary encoded, so the flip columns only
+ * store u32 ids and the whole file can be loaded with a single read */
+namespace flip_store
+{
+	constexpr char magic[8] = { 'R', 'S', 'F', 'L', 'I', 'P', 'D', 'B' };
+	constexpr u32 format_version = 5;
+
+	/* Version 2 files are missing the item aggregates and version 3 and 4 files
+	 * have them in older layouts. They are loaded without the aggregates
+	 * and the aggregates get recalculated */
+	constexpr u32 oldest_supported_version = 2;
+
+	/* Interned strings. Each unique string gets an id that stays stable
+	 * for the lifetime of the database */
+	class dictionary
+	{
+	public:
+		u32 intern(const std::string& str);
+		const std::string& at(const u32 id) const;
+		size_t size() const;
+		const std::vector<std::string>& strings() const;
+		void clear();
+
+	private:
+		std::vector<std::string> values;
+		std::unordered_map<std::string, u32> ids;
+	};
+
+	struct columns
+	{
+		dictionary accounts;
+		dictionary items;
+
+		std::vector<u32> account;
+		std::vector<u32> item;
+		std::vector<i32> buy;
+		std::vector<i32> sell;
+		std::vector<i32> sold;
+		std::vector<i32> limit;
+		std::vector<u8> cancelled;
+		std::vector<u8> done;
+
+		/* Per-item statistics indexed by the item id. Might be shorter than the
+		 * item dictionary, missing entries have no flips done */
+		std::vector<stats::item_aggregate> item_stats;
+
+		i64 flips_done = 0;
+		i64 profit = 0;
+
+		/* Incremented on every checkpoint. Ties the operation log to the file it applies to */
+		u64 generation = 0;
+
+		size_t size() const;
+		void reserve(const size_t flip_count);
+		void clear();
+	};
+
+	__attribute__((warn_unused_result))
+	std::string serialize(const columns& data);
+
+	/* Returns false if the data is not a valid flip store of a supported version */
+	__attribute__((warn_unused_result))
+	bool deserialize(const std::string& bytes, columns& data);
+}
@@ -5,6 +5,7 @@
 #include <nlohmann/json_fwd.hpp>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 namespace flip_utils
 {
@@ -22,8 +23,18 @@ namespace flip_utils
 	std::unordered_set<std::string> read_file_items(const std::string& filepath); /* Read unique item lines from a file */
 	void write_file(const std::string& filepath, const std::string& text);
 	void write_json_file(const nlohmann::json& json_data, const std::string& file_path);
+
+	/* Write all of the data to a file descriptor, retrying on short writes */
+	bool write_fd(const int fd, const std::string& data);
+
+	/* Replace a file atomically. The data is fsync'd before the new file is moved into place */
+	bool write_file_durable(const std::string& filepath, const std::string& data);
 	std::string str_to_lower(const std::string& str);
 
+	/* Split a command line into arguments at whitespace. Double quotes keep the
+	 * spaces in an argument (add -i "Iron bar") and a # outside of quotes starts a comment */
+	std::vector<std::string> split_command_line(const std::string& line);
+
 	// Function that approaches a given value but never really reaches it
 	// After the point of diminishing_returns, the value starts incresing slower
 	// By lowering the slope value, you can make the value increase faster
@@ -5,6 +5,7 @@
 
 #include <nlohmann/json.hpp>
 #include <string>
+#include <vector>
 
 namespace flips
 {
@@ -37,11 +38,17 @@ namespace flips
 	};
 
 	void print_stats(const db& db, const i32 top_value_count = 10);
+
+	/* Mark the flip as cancelled if its data has any of the problems that fix_stats()
+	 * looks for. Returns a description of each problem that was found */
+	std::vector<std::string> repair(flip& flip);
 	void fix_stats(db& db);
+
 	void list(const db& db, const daily_progress& daily_progress, const std::string& account_filter = ""); /* List on-going flips */
-	void cancel(db& db, const i32 ID); /* Cancel an existing flip */
-	void update(db& db, const i32 ID, u32 buy_price, u32 sell_price, u32 buy_amount, std::string account_name); /* Update flip information */
-	void sell(db& db, daily_progress& daily_progress, const i32 index, i32 sell_value, i32 sell_amount);
+	/* These return false if there's no on-going flip with the ID */
+	bool cancel(db& db, const i32 ID); /* Cancel an existing flip */
+	bool update(db& db, const i32 ID, u32 buy_price, u32 sell_price, u32 buy_amount, std::string account_name); /* Update flip information */
+	bool sell(db& db, daily_progress& daily_progress, const i32 index, i32 sell_value, i32 sell_amount);
 
 	/** Filtering **/
 
@@ -55,6 +62,7 @@ namespace flips
 	/* Print filtered data */
 	void filter_name(const db& db, const std::string& name);
 	void filter_count(const db& db, const u32 flip_count);
+	void filter_search(const db& db, const std::string& text); /* List items with names resembling the text */
 
 	/* Flip recommendations */
 	bool flip_recommendations(const db& db, const tip_config& config);
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/* Append-only log of database operations
+ *
+ * Mutations are staged in memory and appended to the log file as a single
+ * fsync'd write on commit. The log belongs to a specific generation of the
+ * main database file, so a log that has already been checkpointed into the
+ * database is never replayed twice */
+class op_log
+{
+public:
+	/* Serializes values into the payload of a single log record */
+	class record
+	{
+	public:
+		template<typename T>
+		void put(const T value)
+		{
+			static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+			payload.append(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		void put(const std::string& str);
+		const std::string& data() const;
+
+	private:
+		std::string payload;
+	};
+
+	/* Reads values back from a record payload in the order they were put in */
+	class record_reader
+	{
+	public:
+		explicit record_reader(std::string_view payload);
+
+		template<typename T>
+		__attribute__((warn_unused_result))
+		bool get(T& value)
+		{
+			static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+			if (payload.size() - offset < sizeof(T))
+				return false;
+
+			std::memcpy(&value, payload.data() + offset, sizeof(T));
+			offset += sizeof(T);
+			return true;
+		}
+
+		__attribute__((warn_unused_result))
+		bool get(std::string& str);
+
+		bool at_end() const;
+
+	private:
+		std::string_view payload;
+		size_t offset = 0;
+	};
+
+	explicit op_log(const std::string& file_path);
+
+	/* Open the log for the given database generation and return the
+	 * payloads of all complete records in it. A stale log from another
+	 * generation or a torn record at the end is thrown away */
+	std::vector<std::string> open(const u64 generation);
+
+	void stage(const record& record); /* Queue a record to be written on the next commit */
+	void commit(); /* Append all staged records to the log file and fsync */
+	void discard(); /* Forget the staged records */
+	bool has_staged() const;
+
+	void reset(const u64 generation); /* Empty the log after a checkpoint */
+
+	size_t size() const; /* Size of the committed log in bytes */
+
+private:
+	std::string file_path;
+	std::string staged;
+	size_t committed_size = 0;
+};
@@ -1,5 +1,24 @@
 #pragma once
 
 #include "DB.hpp"
+#include "Simulator.hpp"
 
-void optimize_v2_recommendation_algorithm(const db& db);
+struct optimize_config
+{
+	u32 thread_count = 1; // zero uses all of the cores
+	u16 scenario_count = 0; // set to non-zero value to compare weights on this many pre-generated scenarios
+
+	u64 seed = 0; // used only if fixed_seed is set, otherwise the seed is random
+	bool fixed_seed = false;
+
+	u64 max_iterations = 0; // zero means no limit
+	u32 time_budget = 0; // seconds, zero means no limit
+
+	bool resume = false; // continue from the checkpoint file
+
+	simulator::config simulation; // the resumed search keeps the settings that it was started with
+};
+
+/* Search for better v2 weights with repeated simulations. The progress is
+ * checkpointed to the data directory and better weights are saved there too */
+void optimize_v2_recommendation_algorithm(const db& db, const optimize_config& config);
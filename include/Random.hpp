@@ -1,8 +1,15 @@
 #pragma once
 
+#include "Types.hpp"
+
+#include <array>
 #include <cassert>
-#include <random>
+#include <span>
+#include <string>
+#include <type_traits>
 
+/* xoshiro256** random number generator. The whole state fits in four integers,
+ * so it is cheap to copy and to keep in registers in the hot loops */
 class random
 {
 public:
@@ -20,39 +27,151 @@ public:
 	 *
 	 * @param seed
 	 */
-	void seed(unsigned int seed);
+	void seed(u64 seed);
+
+	/**
+	 * @brief Derive the seed of a numbered random number stream from a base seed
+	 *
+	 * Streams with different numbers are independent of each other, so work
+	 * that is split into numbered parts can be reproduced with the same base
+	 * seed no matter which thread runs which part.
+	 */
+	static u64 stream_seed(u64 seed, u64 stream);
+
+	/**
+	 * @brief Save the state of the random number engine so that the
+	 * sequence can be continued later on
+	 */
+	std::string state() const;
+
+	/**
+	 * @brief Restore a state returned by state()
+	 *
+	 * @return false if the state is not valid. The engine is left untouched in that case
+	 */
+	bool set_state(const std::string& state);
+
+	/**
+	 * @brief Advance the engine by 2^128 numbers
+	 *
+	 * Jumping a copy of the engine once per parallel worker gives each
+	 * worker its own non-overlapping part of the sequence.
+	 */
+	void jump();
 
 	/**
 	 * @brief Get the next random number from the random number engine
 	 */
-	unsigned long next();
+	u64 next()
+	{
+		return next(engine_state);
+	}
 
 	/**
 	 * @brief Generate a random integer value between min and max (inclusive)
+	 *
+	 * Every value in the range is equally likely
 	 */
 	template<typename T>
 	T range(const T min, const T max)
 	{
+		static_assert(std::is_integral_v<T>);
 		assert(min <= max);
 
-		if (min == max)
-			return min;
+		using unsigned_type = std::make_unsigned_t<T>;
+		const u64 span = static_cast<u64>(static_cast<unsigned_type>(static_cast<unsigned_type>(max) - static_cast<unsigned_type>(min))) + 1;
+
+		// the range covers all 64-bit values
+		if (span == 0)
+			return static_cast<T>(next());
 
-		return rng_engine() % (max + 1 - min) + min;
+		return static_cast<T>(static_cast<unsigned_type>(static_cast<unsigned_type>(min) + bounded(span)));
 	}
 
 	/**
-	 * @brief Generate a random floating point value between min and max
+	 * @brief Generate a random floating point value between min (inclusive) and max (exclusive)
 	 *
 	 * @warning Using this method with integer values will return non-random values. Only use this method with floating point ranges
 	 */
 	template<typename T>
 	T range_float(T min, T max)
 	{
-		T multiplier = (static_cast<T>(rng_engine())) / rng_engine.max();
-		return (multiplier * (max - min)) + min;
+		return (unit<T>(next()) * (max - min)) + min;
+	}
+
+	/**
+	 * @brief Fill the values with random numbers between 0 (inclusive) and 1 (exclusive)
+	 *
+	 * Gives the same values as calling range_float(0, 1) for each value in order
+	 */
+	template<typename T>
+	void fill_uniform(std::span<T> values)
+	{
+		static_assert(std::is_floating_point_v<T>);
+
+		// work on a local copy of the state so that it stays in registers
+		std::array<u64, 4> state = engine_state;
+		for (T& value : values)
+			value = unit<T>(next(state));
+
+		engine_state = state;
 	}
 
 private:
-	std::mt19937_64 rng_engine;
+	std::array<u64, 4> engine_state;
+
+	static u64 rotl(const u64 value, const int shift)
+	{
+		return (value << shift) | (value >> (64 - shift));
+	}
+
+	static u64 next(std::array<u64, 4>& state)
+	{
+		const u64 result = rotl(state[1] * 5, 7) * 9;
+		const u64 t = state[1] << 17;
+
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = rotl(state[3], 45);
+
+		return result;
+	}
+
+	/* A value between 0 and 1 (exclusive) from the top bits of the number. Only as many
+	 * bits are used as the type has precision, so the value can't round up to 1 */
+	template<typename T>
+	static T unit(const u64 value)
+	{
+		static_assert(std::is_floating_point_v<T>);
+
+		if constexpr (sizeof(T) == sizeof(f32))
+			return static_cast<T>(value >> 40) * 0x1.0p-24f;
+		else
+			return static_cast<T>(static_cast<f64>(value >> 11) * 0x1.0p-53);
+	}
+
+	/* A value below the given limit without modulo bias (Lemire's method) */
+	u64 bounded(const u64 limit)
+	{
+		__extension__ typedef unsigned __int128 u128;
+
+		u128 product = static_cast<u128>(next()) * limit;
+		u64 low = static_cast<u64>(product);
+
+		if (low < limit)
+		{
+			// reject the values that would make the smaller results more likely
+			const u64 threshold = -limit % limit;
+			while (low < threshold)
+			{
+				product = static_cast<u128>(next()) * limit;
+				low = static_cast<u64>(product);
+			}
+		}
+
+		return static_cast<u64>(product >> 64);
+	}
 };
@@ -5,11 +5,12 @@
 #include "Types.hpp"
 
 #include <algorithm>
+#include <cassert>
 #include <cmath>
-#include <functional>
 #include <array>
+#include <string>
+#include <vector>
 
-constexpr u8 v2_variable_count = 8;
 // static inline std::array<f64, v2_variable_count> v2_recommendation_algorithm_weights = {
 // 	0.254,  // avg profit
 // 	0.263,  // success rate
@@ -21,33 +22,174 @@ constexpr u8 v2_variable_count = 8;
 // 	0.2,
 // };
 
+/* The weights that new scoring contexts start with */
 inline std::array<f64, v2_variable_count> v2_recommendation_algorithm_weights = { 0.118973, 0.197536, 0.136292, 0.0262364, 0.0178793, 0.146605, 0.138587, 0.217891 };
 
-f64 v2_recommendation_algorithm(const stats::avg_stat& stat, const std::array<f64, v2_variable_count>& weights);
+/* The recommendation algorithms work with both avg_stat and avg_stat_table::row */
+template<typename stat_type>
+f64 v1_recommendation_algorithm(const stat_type& stat, const stats::scoring_context& context)
+{
+	constexpr f64 flip_age_penaly = 0.005; // Higher value lowers the score more for stale flips
+	constexpr f64 flip_index_age_exponent = 0.9; // Increase the impact of flip age
+	f64 flip_age_debuff = 1.0 - (flip_age_penaly * std::pow(context.total_flip_count - stat.latest_trade_index(), flip_index_age_exponent));
 
-static inline std::array<std::function<f64(const stats::avg_stat& stat)>, 2> recommendation_algorithms = {
-	[](const stats::avg_stat& stat) -> f64 // v1
+	// Set limits to the age penalty
+	constexpr f64 min_penalty = 0.001;
+	constexpr f64 max_penalty = 1.0;
+	flip_age_debuff = std::clamp(flip_age_debuff, min_penalty, max_penalty);
+
+	const f64 roi_modifier = flip_utils::limes(2, 1.5, 1, stat.avg_roi());
+	const f64 flip_count_modifier = flip_utils::limes(2, 1, 3, stat.flip_count());
+
+	constexpr f32 profit_exponent = 1.50f;
+
+	constexpr f32 inverse_divisor = 1.0 / 10000.0;
+	constexpr u32 rolling_avg_window_size = 10;
+	return std::round((std::pow(stat.rolling_avg_profit(rolling_avg_window_size), profit_exponent) * flip_age_debuff * roi_modifier * flip_count_modifier) * inverse_divisor);
+}
+
+/* The inputs of the v2 algorithm. These don't depend on the weights */
+template<typename stat_type>
+std::array<f64, v2_variable_count> v2_recommendation_variables(const stat_type& stat, const stats::scoring_context& context)
+{
+	return {
+		// avg profit
+		stat.normalized_avg_profit(context),
+
+		// success rate
+		stat.profitable_flip_count() / static_cast<f64>(stat.flip_count()),
+
+		// consistency
+		1.0 / (stat.profit_standard_deviation() + 1),
+
+		// cancellation penalty
+		1.0 - stat.cancellation_ratio(),
+
+		// how many flips have been done
+		stat.flip_count() >= 15 ? 1.0 : stat.flip_count() / 15.0,
+
+		// average return on investment
+		stat.normalized_avg_roi(context),
+
+		// average buy limit
+		stat.normalized_avg_buy_limit(context),
+
+		// reversed average buy limit
+		1.0 - stat.normalized_avg_buy_limit(context)
+	};
+}
+
+/* Lowers the v2 score of flips with out-of-date data */
+template<typename stat_type>
+f64 v2_flip_age_penalty(const stat_type& stat, const stats::scoring_context& context)
+{
+	// lower the score for flips with out-of-date data
+	const f64 flip_age = stat.latest_trade_index() / static_cast<f64>(context.total_flip_count);
+	return std::clamp(flip_age, 0.90, 1.0);
+}
+
+template<typename stat_type>
+f64 v2_recommendation_algorithm(const stat_type& stat, const stats::scoring_context& context)
+{
+	// variables and their weights
+	const std::array<f64, v2_variable_count> variables = v2_recommendation_variables(stat, context);
+
+	f64 composite_score{0};
+	for (u8 i = 0; i < v2_variable_count; ++i)
+		composite_score += variables[i] * context.weights[i];
+
+	assert(composite_score <= static_cast<f64>(v2_variable_count));
+
+	return composite_score * v2_flip_age_penalty(stat, context);
+}
+
+/* Replace the built-in v2 weights with the ones saved by the optimizer. Returns false
+ * if there are no saved weights or they are not valid */
+bool load_v2_recommendation_weights(const std::string& file_path);
+void save_v2_recommendation_weights(const std::array<f64, v2_variable_count>& weights, const std::string& file_path);
+
+/* The v2 variables of a set of items calculated only once. Scoring all
+ * of the items with new weights is then a single matrix-vector product,
+ * which is what the weight optimizer does on every iteration */
+class v2_feature_matrix
+{
+public:
+	v2_feature_matrix(const stats::avg_stat_table& stats, const stats::scoring_context& context);
+
+	/* Instruction sets that the items can be scored with */
+	enum class instruction_set
 	{
-		constexpr f64 flip_age_penaly = 0.005; // Higher value lowers the score more for stale flips
-		constexpr f64 flip_index_age_exponent = 0.9; // Increase the impact of flip age
-		f64 flip_age_debuff = 1.0 - (flip_age_penaly * std::pow(stat.total_flip_count() - stat.latest_trade_index(), flip_index_age_exponent));
+		scalar, avx2, avx512
+	};
+
+	static bool is_supported(const instruction_set set);
+
+	/* The fastest instruction set that the CPU supports */
+	static instruction_set best_instruction_set();
 
-		// Set limits to the age penalty
-		constexpr f64 min_penalty = 0.001;
-		constexpr f64 max_penalty = 1.0;
-		flip_age_debuff = std::clamp(flip_age_debuff, min_penalty, max_penalty);
+	static std::string instruction_set_name(const instruction_set set);
 
-		const f64 roi_modifier = flip_utils::limes(2, 1.5, 1, stat.avg_roi());
-		const f64 flip_count_modifier = flip_utils::limes(2, 1, 3, stat.flip_count());
+	/* Same scores as v2_recommendation_algorithm() would give each item with these weights */
+	void score(const std::array<f64, v2_variable_count>& weights, std::vector<f64>& scores) const;
+	void score(const std::array<f64, v2_variable_count>& weights, std::vector<f64>& scores, const instruction_set set) const;
 
-		constexpr f32 profit_exponent = 1.50f;
+	/* Score the items and find the indices of the top_count best ones in
+	 * descending order. Ties are broken by the item index */
+	void rank(const std::array<f64, v2_variable_count>& weights, std::vector<f64>& scores, std::vector<u32>& ranking, const size_t top_count) const;
 
-		constexpr f32 inverse_divisor = 1.0 / 10000.0;
-		constexpr u32 rolling_avg_window_size = 10;
-		return std::round((std::pow(stat.rolling_avg_profit(rolling_avg_window_size), profit_exponent) * flip_age_debuff * roi_modifier * flip_count_modifier) * inverse_divisor);
-	},
-	[](const stats::avg_stat& stat) -> f64 // v2
+	size_t item_count() const;
+
+private:
+	/* Each variable is stored contiguously over all of the items (with the
+	 * item count padded to the widest SIMD width) so that a few items can be scored at once */
+	std::vector<f64> variables;
+	std::vector<f64> age_penalties;
+	size_t items;
+	size_t stride;
+};
+
+/* The recommendation algorithms as types. Loops over the items can be instantiated
+ * for each algorithm, so that picking the algorithm doesn't cost anything per item
+ * and the scoring can get inlined into the loop */
+struct v1_algorithm
+{
+	template<typename stat_type>
+	static f64 score(const stat_type& stat, const stats::scoring_context& context)
 	{
-		return v2_recommendation_algorithm(stat, v2_recommendation_algorithm_weights);
+		if (stat.flip_count() == 0)
+			return 0;
+
+		assert(context.total_flip_count > 0);
+		return v1_recommendation_algorithm(stat, context);
 	}
 };
+
+struct v2_algorithm
+{
+	template<typename stat_type>
+	static f64 score(const stat_type& stat, const stats::scoring_context& context)
+	{
+		if (stat.flip_count() == 0)
+			return 0;
+
+		assert(context.total_flip_count > 0);
+		return v2_recommendation_algorithm(stat, context);
+	}
+};
+
+/* Call the function with the algorithm type selected in the context, for example
+ * with_recommendation_algorithm(context, [&](auto algorithm) { return decltype(algorithm)::score(stat, context); }) */
+template<typename F>
+decltype(auto) with_recommendation_algorithm(const stats::scoring_context& context, F&& function)
+{
+	switch (context.algorithm)
+	{
+		case stats::recommendation_algorithm::v1:
+			return function(v1_algorithm{});
+
+		case stats::recommendation_algorithm::v2:
+			break;
+	}
+
+	return function(v2_algorithm{});
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Types.hpp"
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+/* Keeps the database loaded in a long running process, so that commands
+ * don't need to load and write the whole database every time
+ *
+ * The server listens on a Unix domain socket and runs the commands sent by
+ * clients one at a time. A client sends its command line arguments and gets
+ * back the exit code and whatever the command printed */
+namespace server
+{
+	/* Runs a command line and returns its exit code. Everything that it
+	 * prints to std::cout gets sent back to the client */
+	using command_handler = std::function<i32(const std::vector<std::string>& args)>;
+
+	struct response
+	{
+		i32 exit_code;
+		std::string output;
+	};
+
+	/* Serve commands until interrupted with SIGINT or SIGTERM or until stop() is called */
+	i32 serve(const std::string& socket_path, const command_handler& handler);
+	void stop();
+
+	/* True if a server is listening on the socket */
+	bool is_running(const std::string& socket_path);
+
+	/* Run the command on the server listening on the socket. Returns nothing if
+	 * there is no server, in which case the command can be run locally */
+	__attribute__((warn_unused_result))
+	std::optional<response> forward(const std::string& socket_path, const std::vector<std::string>& args);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "AvgStat.hpp"
+#include "Types.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <span>
+#include <vector>
+
+/* Simulated flipping with a ranking of flips. Every hour the best ranked items
+ * that aren't on a buy limit cooldown fill the GE slots, unless the flip gets
+ * cancelled. The items are bits in a 64-bit mask and the cooldowns are a timing
+ * wheel of masks, so an hour only touches the items that get flipped */
+namespace simulator
+{
+	/* One bit per item in the masks */
+	constexpr u8 max_top_flip_count = 64;
+
+	struct config
+	{
+		u8 hours = 48; // how many hours of flipping is simulated
+		u8 slot_count = 8; // how many items can be flipped at the same time
+		u8 top_flip_count = 50; // how many of the best ranked flips are picked from
+		u8 cooldown = 4; // hours until a flipped item can be bought again
+		u8 cancelled_cooldown = 5; // a cancelled flip waits a bit longer before it is tried again
+
+		bool operator==(const config&) const = default;
+	};
+
+	/* The values that the simulation needs from each of the top ranked flips */
+	class ranked_flips
+	{
+	public:
+		ranked_flips(const stats::avg_stat_table& flips, const std::vector<u32>& ranking, const config& settings);
+
+		u8 size() const;
+		f64 cancellation_ratio(const u8 rank) const;
+
+		/* Each rank always gets the same one of the recent profits of the item */
+		i64 profit(const u8 rank) const;
+
+	private:
+		std::vector<f64> cancellation_ratios;
+		std::vector<i64> profits;
+	};
+
+	/* Simulate a run for each of the profits in lockstep and write the total profit of the
+	 * run to it. draw(run, hour, rank) returns a value between 0 and 1 that decides if the
+	 * flip at the rank gets cancelled. Each run calls it in the hour and rank order */
+	template<typename F>
+	void run(const config& settings, const ranked_flips& flips, std::span<f64> profits, F&& draw)
+	{
+		assert(settings.top_flip_count <= max_top_flip_count);
+
+		// an item that is put on a cooldown can be flipped again on the next hour at the earliest
+		const u32 cooldown = std::max<u32>(settings.cooldown, 1);
+		const u32 cancelled_cooldown = std::max<u32>(settings.cancelled_cooldown, 1);
+		const u32 wheel_size = std::bit_ceil(std::max(cooldown, cancelled_cooldown) + 1);
+		const u32 wheel_mask = wheel_size - 1;
+
+		const u64 all_flips = flips.size() == 64 ? ~u64{0} : (u64{1} << flips.size()) - 1;
+
+		// the items that can be flipped and the items that come off of the cooldown on each hour of the wheel
+		std::vector<u64> available(profits.size(), all_flips);
+		std::vector<u64> wheels(profits.size() * wheel_size, 0);
+
+		std::fill(profits.begin(), profits.end(), 0.0);
+
+		for (u32 hour = 0; hour < settings.hours; ++hour)
+		{
+			const u32 slot = hour & wheel_mask;
+
+			for (size_t r = 0; r < profits.size(); ++r)
+			{
+				u64* wheel = &wheels[r * wheel_size];
+				u64 candidates = available[r] | wheel[slot];
+				wheel[slot] = 0;
+
+				u64 flippable = candidates;
+				u8 flipped_item_count{0};
+
+				while (candidates != 0 && flipped_item_count < settings.slot_count)
+				{
+					const u8 rank = std::countr_zero(candidates);
+					const u64 bit = u64{1} << rank;
+					candidates &= candidates - 1;
+					flippable &= ~bit;
+
+					if (draw(r, hour, rank) < flips.cancellation_ratio(rank))
+					{
+						wheel[(hour + cancelled_cooldown) & wheel_mask] |= bit;
+						continue;
+					}
+
+					profits[r] += flips.profit(rank);
+					wheel[(hour + cooldown) & wheel_mask] |= bit;
+					flipped_item_count++;
+				}
+
+				available[r] = flippable;
+			}
+		}
+	}
+}
@@ -2,6 +2,8 @@
 
 #include "AvgStat.hpp"
 
+#include <cstdint>
+#include <functional>
 #include <nlohmann/json_fwd.hpp>
 #include <vector>
 
@@ -13,6 +15,29 @@ namespace stats
 	__attribute__((hot, const))
 	f64 calc_roi(const nlohmann::json& flip);
 
+	// indices of the flips ordered from the highest key value to the lowest
+	//
+	// each key is calculated only once and the flips themselves aren't moved
+	// around. Only the best count indices are sorted and returned, equal
+	// values are ordered by their index
+	__attribute__((warn_unused_result))
+	std::vector<u32> rank_flips_by_roi(const std::vector<avg_stat>& flips, const size_t count = SIZE_MAX);
+
+	__attribute__((warn_unused_result))
+	std::vector<u32> rank_flips_by_profit(const std::vector<avg_stat>& flips, const size_t count = SIZE_MAX);
+
+	__attribute__((warn_unused_result))
+	std::vector<u32> rank_flips_by_recommendation(const std::vector<avg_stat>& flips, const scoring_context& context, const size_t count = SIZE_MAX);
+
+	__attribute__((warn_unused_result))
+	std::vector<u32> rank_flips_by_roi(const avg_stat_table& flips, const size_t count = SIZE_MAX);
+
+	__attribute__((warn_unused_result))
+	std::vector<u32> rank_flips_by_profit(const avg_stat_table& flips, const size_t count = SIZE_MAX);
+
+	__attribute__((warn_unused_result))
+	std::vector<u32> rank_flips_by_recommendation(const avg_stat_table& flips, const scoring_context& context, const size_t count = SIZE_MAX);
+
 	__attribute__((cold))
 	std::vector<avg_stat> sort_flips_by_roi(std::vector<avg_stat> flips);
 
@@ -20,12 +45,26 @@ namespace stats
 	std::vector<avg_stat> sort_flips_by_profit(std::vector<avg_stat> flips);
 
 	__attribute__((cold))
-	std::vector<avg_stat> sort_flips_by_recommendation(std::vector<avg_stat> flips);
+	std::vector<avg_stat> sort_flips_by_recommendation(std::vector<avg_stat> flips, const scoring_context& context);
 
 	// optimized version of sort_flips_by_recommendation,
 	// but avoids unnecessary copying
 	//
 	// mainly useful for the v2 algo optimization
 	__attribute__((hot))
-	void sort_flips_by_recommendation_direct(std::vector<avg_stat>& flips);
+	void sort_flips_by_recommendation_direct(std::vector<avg_stat>& flips, const scoring_context& context);
+
+	struct top_flips
+	{
+		std::vector<u32> ranked;	// indices of the flips that were looked at, best first
+		std::vector<u32> accepted;	// the accepted ones out of those in the same order
+	};
+
+	// pick the best recommendations without sorting all of the flips
+	//
+	// each recommendation score is calculated only once and the flips are
+	// looked at from the best to worst until count of them have been accepted
+	// equal scores are ordered by their index
+	__attribute__((hot))
+	top_flips select_top_flips_by_recommendation(const avg_stat_table& flips, const scoring_context& context, const size_t count, const std::function<bool(const avg_stat_table::row&)>& accept);
 }
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "DB.hpp"
+#include "Types.hpp"
+
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Bulk import and export of flips as CSV or JSON lines
+ *
+ * Both formats have one flip per line with the same fields as the legacy json
+ * database: item, buy, sell, sold, limit, cancelled, done and account. The input
+ * is read in fixed size chunks and parsed one line at a time straight into the
+ * database, so the memory used doesn't grow with the size of the file */
+namespace transfer
+{
+	enum class format
+	{
+		csv, jsonl
+	};
+
+	/* Files ending with .jsonl or .ndjson are JSON lines, anything else is CSV */
+	__attribute__((warn_unused_result))
+	format format_from_path(const std::string& path);
+
+	struct import_result
+	{
+		u64 imported{}; // flips added to the database
+		u64 cancelled{}; // imported flips that had problems and were marked as cancelled
+		u64 skipped{}; // lines that couldn't be parsed
+	};
+
+	/* Add the flips to the database. The flips are validated with the same rules as
+	 * flips::fix_stats() and the profit statistics are updated. Returns nothing if
+	 * the input can't be imported at all, for example because of a bad CSV header */
+	__attribute__((warn_unused_result))
+	std::optional<import_result> import_flips(std::istream& input, const format file_format, db& db);
+
+	void export_flips(const db& db, const format file_format, std::ostream& output);
+
+	/* Splits the input into lines while reading it in fixed size chunks. A line
+	 * is copied only if it continues past the end of a chunk */
+	class line_reader
+	{
+	public:
+		explicit line_reader(std::istream& input, const size_t chunk_size = 1024 * 1024);
+
+		/* Returns false once the input has run out. The line stays valid until
+		 * the next call and has no line ending */
+		bool next(std::string_view& line);
+
+	private:
+		std::istream& input;
+		std::vector<char> chunk;
+		size_t position{};
+		size_t chunk_end{};
+		bool input_ended = false;
+
+		/* The start of a line that continues in the next chunk */
+		std::string partial_line;
+		bool partial_line_returned = false;
+	};
+}
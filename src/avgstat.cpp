@@ -1,98 +1,225 @@
 #include "AvgStat.hpp"
+#include "DB.hpp"
 #include "FlipUtils.hpp"
 #include "Flips.hpp"
 #include "Margin.hpp"
 #include "Recommendations.hpp"
 #include "Stats.hpp"
 
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <doctest/doctest.h>
 #include <iostream>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <thread>
 
 namespace stats
 {
-	static inline recommendation_algorithm current_algorithm = recommendation_algorithm::v2;
-
 	avg_stat::avg_stat()
 	:name("null")
 	{}
 
 	avg_stat::avg_stat(const std::string& item_name)
 	:name(item_name)
+	{}
+
+	avg_stat::avg_stat(const std::string& item_name, const item_aggregate& aggregate)
+	:name(item_name), aggregate(aggregate)
 	{
-		total_profit 		= 0;
-		total_roi 			= 0;
-		total_item_count 	= 0;
+		update_recent_profit_sums();
 	}
 
-	void avg_stat::add_data(const i64 profit, const f64 ROI, const u32 item_count, const u32 latest_trade_index)
+	void item_aggregate::add_flip(const i64 profit, const f64 ROI, const u32 item_count, const u32 trade_index)
 	{
-		profit_list.push_back(profit);
-
 		total_profit 		+= profit;
 		total_roi 			+= ROI;
 		total_item_count 	+= item_count;
+		flip_count++;
+
+		min_profit = flip_count == 1 ? profit : std::min(min_profit, profit);
+		max_profit = flip_count == 1 ? profit : std::max(max_profit, profit);
 
-		if (this->_latest_trade_index < latest_trade_index)
+		const f64 delta = profit - profit_mean;
+		profit_mean += delta / flip_count;
+		profit_m2 += delta * (profit - profit_mean);
+
+		if (profit > 0)
+			profitable_flip_count++;
+
+		if (latest_trade_index < trade_index)
+			latest_trade_index = trade_index;
+
+		/* Flips are usually sold in the order they were added, so the profit
+		 * gets appended to the end of the window. Older flips that get sold
+		 * late are inserted to their place by trade index instead */
+		u32 position = recent_count;
+		while (position > 0 && recent_trade_indices[position - 1] > trade_index)
+			--position;
+
+		if (recent_count == recent_profit_window_size)
 		{
-			this->_latest_trade_index = latest_trade_index;
+			/* Older than anything in the window */
+			if (position == 0)
+				return;
+
+			/* Make room by dropping the oldest profit */
+			std::copy(recent_trade_indices.begin() + 1, recent_trade_indices.begin() + position, recent_trade_indices.begin());
+			std::copy(recent_profits.begin() + 1, recent_profits.begin() + position, recent_profits.begin());
+			--position;
+		}
+		else
+		{
+			std::copy_backward(recent_trade_indices.begin() + position, recent_trade_indices.begin() + recent_count, recent_trade_indices.begin() + recent_count + 1);
+			std::copy_backward(recent_profits.begin() + position, recent_profits.begin() + recent_count, recent_profits.begin() + recent_count + 1);
+			++recent_count;
+		}
+
+		recent_trade_indices[position] = trade_index;
+		recent_profits[position] = profit;
+	}
+
+	void item_aggregate::add_cancel()
+	{
+		cancelled_flip_count++;
+	}
+
+	TEST_CASE("Recent profit window")
+	{
+		item_aggregate aggregate;
+
+		for (u32 i = 0; i < recent_profit_window_size + 5; ++i)
+			aggregate.add_flip(i, 0, 1, i + 100);
 
-			// Attempt to keep the total flip amount up-to-date
-			if (latest_trade_index > _total_flip_count)
-				_total_flip_count = latest_trade_index;
+		CHECK(aggregate.flip_count == recent_profit_window_size + 5);
+		CHECK(aggregate.recent_count == recent_profit_window_size);
+		CHECK(aggregate.recent_profits.front() == 5);
+		CHECK(aggregate.recent_profits.back() == recent_profit_window_size + 4);
+
+		SUBCASE("Flips older than the window are only counted in the totals")
+		{
+			aggregate.add_flip(-1000, 0, 1, 50);
+			CHECK(aggregate.recent_profits.front() == 5);
+			CHECK(aggregate.total_profit == 190 - 1000);
+		}
+
+		SUBCASE("Late sales are inserted by trade index")
+		{
+			aggregate.add_flip(-1000, 0, 1, 110);
+			CHECK(aggregate.recent_profits.front() == 6);
+			CHECK(aggregate.recent_trade_indices[5] == 110);
+			CHECK(aggregate.recent_profits[5] == -1000);
+			CHECK(std::is_sorted(aggregate.recent_trade_indices.begin(), aggregate.recent_trade_indices.end()));
 		}
 	}
 
+	void avg_stat::add_data(const i64 profit, const f64 ROI, const u32 item_count, const u32 latest_trade_index)
+	{
+		aggregate.add_flip(profit, ROI, item_count, latest_trade_index);
+		update_recent_profit_sums();
+	}
+
 	void avg_stat::inc_cancel_count()
 	{
-		_cancelled_flip_count++;
+		aggregate.add_cancel();
 	}
 
 	f64 avg_stat::avg_profit() const
 	{
-		return flip_count() == 0 ? 0 : total_profit / static_cast<double>(flip_count());
+		return flip_count() == 0 ? 0 : aggregate.total_profit / static_cast<double>(flip_count());
 	}
 
-	f64 avg_stat::normalized_avg_profit() const
+	f64 avg_stat::normalized_avg_profit(const scoring_context& context) const
 	{
-		return (avg_profit() - min_avg_profit) / (max_avg_profit - min_avg_profit);
+		return (avg_profit() - context.min_avg_profit) / (context.max_avg_profit - context.min_avg_profit);
 	}
 
 	f64 avg_stat::profit_standard_deviation() const
 	{
-		assert(!profit_list.empty());
+		assert(flip_count() != 0);
+
+		const f64 variance = aggregate.profit_m2 / flip_count();
+		const f64 standard_deviation = std::sqrt(variance);
+
+		return standard_deviation;
+	}
+
+	i64 avg_stat::min_profit() const
+	{
+		return aggregate.min_profit;
+	}
+
+	i64 avg_stat::max_profit() const
+	{
+		return aggregate.max_profit;
+	}
+
+	TEST_CASE("Running profit statistics")
+	{
+		/* Two-pass reference values */
+		const auto check_against_reference = [](const std::vector<i64>& profits)
+		{
+			avg_stat stat("Item");
+			for (size_t i = 0; i < profits.size(); ++i)
+				stat.add_data(profits[i], 0, 1, i);
+
+			const f64 mean = std::accumulate(profits.begin(), profits.end(), 0.0) / profits.size();
+			const f64 sum_of_squared_differences = std::accumulate(profits.begin(), profits.end(), 0.0, [mean](const f64 total, const i64 profit) {
+				return total + (profit - mean) * (profit - mean);
+			});
+
+			CHECK(stat.avg_profit() == doctest::Approx(mean));
+			CHECK(stat.profit_standard_deviation() == doctest::Approx(std::sqrt(sum_of_squared_differences / profits.size())));
+			CHECK(stat.min_profit() == *std::min_element(profits.begin(), profits.end()));
+			CHECK(stat.max_profit() == *std::max_element(profits.begin(), profits.end()));
+		};
+
+		SUBCASE("Single flip")
+		{
+			check_against_reference({ -509556 });
+		}
 
-		const f64 mean = avg_profit();
+		SUBCASE("Mixed profits")
+		{
+			check_against_reference({ 100, -250, 12000, 0, 4, 4, 99999, -3 });
+		}
 
-		std::vector<f64> squared_differences(profit_list.size());
-		for (const i32 p : profit_list)
+		SUBCASE("Big profits with a small spread")
 		{
-			const f64 difference = p - mean;
-			squared_differences.push_back(difference * difference);
+			std::vector<i64> profits;
+			for (i64 i = 0; i < 1000; ++i)
+				profits.push_back(2'000'000'000 + (i * 7919) % 101);
+
+			check_against_reference(profits);
 		}
 
-		const f64 sum_of_squared_differences = std::accumulate(squared_differences.begin(), squared_differences.end(), 0.0f);
-		const f64 variance = sum_of_squared_differences / squared_differences.size();
-		const f64 standard_deviation = std::sqrt(variance);
+		SUBCASE("Equal profits")
+		{
+			avg_stat stat("Item");
+			for (u32 i = 0; i < 50; ++i)
+				stat.add_data(1'234'567, 0, 1, i);
 
-		return standard_deviation;
+			CHECK(stat.profit_standard_deviation() == 0);
+		}
 	}
 
-	f64 avg_stat::rolling_avg_profit(const u32 window_size) const
+	void avg_stat::update_recent_profit_sums()
 	{
-		if (profit_list.empty())
-			return 0;
-
-		/* Count the total "rolling" profit */
+		const std::span<const i64> profit_list = profits();
+		for (u32 i = 0; i < profit_list.size(); ++i)
+			recent_profit_sums[i + 1] = recent_profit_sums[i] + profit_list[profit_list.size() - 1 - i];
+	}
 
-		const bool flip_list_longer_than_profit_queue = profit_list.size() >= window_size;
-		const size_t first_flip = flip_list_longer_than_profit_queue ? profit_list.size() - window_size : 0;
-		const u32 rolling_profit_count = flip_list_longer_than_profit_queue ? window_size : profit_list.size();
+	f64 avg_stat::rolling_avg_profit(const u32 window_size) const
+	{
+		assert(window_size <= recent_profit_window_size);
 
-		const i64 rolling_total_profit = std::accumulate(profit_list.begin() + first_flip, profit_list.end(), 0);
+		const u32 rolling_profit_count = std::min(window_size, recent_profit_count());
+		if (rolling_profit_count == 0)
+			return 0;
 
-		assert(rolling_profit_count != 0 && "Zero division");
-		return rolling_total_profit / static_cast<double>(rolling_profit_count);
+		return recent_profit_sums[rolling_profit_count] / static_cast<double>(rolling_profit_count);
 	}
 
 	TEST_CASE("Rolling average profit")
@@ -111,76 +238,123 @@ namespace stats
 			CHECK(granite.avg_profit() == profit);
 			CHECK(granite.rolling_avg_profit(10) == profit);
 		}
+
+		SUBCASE("Only the latest flips count")
+		{
+			avg_stat item("Item");
+			for (i32 i = 1; i <= 20; ++i)
+				item.add_data(i * 10, 0, 1, i);
+
+			/* 200 + 190 + 180 */
+			CHECK(item.rolling_avg_profit(3) == 190);
+			CHECK(item.rolling_avg_profit(10) == 155);
+			CHECK(item.rolling_avg_profit(0) == 0);
+
+			/* A late sale with an old trade index doesn't change the latest profits */
+			item.add_data(-100'000, 0, 1, 19);
+			CHECK(item.recent_profit(0) == 200);
+			CHECK(item.recent_profit(1) == -100'000);
+			CHECK(item.rolling_avg_profit(2) == (200 - 100'000) / 2.0);
+		}
+
+		SUBCASE("Big profits don't overflow")
+		{
+			avg_stat item("Party hat");
+			for (u32 i = 0; i < recent_profit_window_size; ++i)
+				item.add_data(2'000'000'000, 0, 1, i);
+
+			CHECK(item.rolling_avg_profit(recent_profit_window_size) == 2'000'000'000);
+		}
+
+		SUBCASE("Profits beyond 32 bits are kept")
+		{
+			avg_stat item("3rd age platebody");
+			item.add_data(5'000'000'000, 0, 1, 1);
+			item.add_data(-3'000'000'000, 0, 1, 2);
+
+			CHECK(item.recent_profit(0) == -3'000'000'000);
+			CHECK(item.recent_profit(1) == 5'000'000'000);
+			CHECK(item.rolling_avg_profit(2) == 1'000'000'000);
+
+			const avg_stat_table table({ item });
+			CHECK(table[0].recent_profit(1) == 5'000'000'000);
+			CHECK(table[0].rolling_avg_profit(1) == -3'000'000'000);
+		}
+
+		SUBCASE("Fewer flips than the window")
+		{
+			avg_stat item("Item");
+			item.add_data(10, 0, 1, 0);
+			item.add_data(20, 0, 1, 1);
+			CHECK(item.rolling_avg_profit(10) == 15);
+			CHECK(avg_stat("Item", item_aggregate()).rolling_avg_profit(10) == 0);
+		}
 	}
 
 	f64 avg_stat::avg_roi() const
 	{
-		return flip_count() == 0 ? 0 : total_roi / static_cast<double>(flip_count());
+		return flip_count() == 0 ? 0 : aggregate.total_roi / static_cast<double>(flip_count());
 	}
 
-	f64 avg_stat::normalized_avg_roi() const
+	f64 avg_stat::normalized_avg_roi(const scoring_context& context) const
 	{
-		return (avg_roi() - min_avg_roi) / (max_avg_roi - min_avg_roi);
+		return (avg_roi() - context.min_avg_roi) / (context.max_avg_roi - context.min_avg_roi);
 	}
 
 	f64 avg_stat::avg_buy_limit() const
 	{
-		return flip_count() == 0 ? 0 : total_item_count / static_cast<double>(flip_count());
+		return flip_count() == 0 ? 0 : aggregate.total_item_count / static_cast<double>(flip_count());
 	}
 
-	f64 avg_stat::normalized_avg_buy_limit() const
+	f64 avg_stat::normalized_avg_buy_limit(const scoring_context& context) const
 	{
-		return (avg_buy_limit() - min_avg_buy_limit) / (max_avg_buy_limit - min_avg_buy_limit);
+		return (avg_buy_limit() - context.min_avg_buy_limit) / (context.max_avg_buy_limit - context.min_avg_buy_limit);
 	}
 
-	f64 avg_stat::flip_recommendation() const
+	f64 avg_stat::flip_recommendation(const scoring_context& context) const
 	{
-		assert(_total_flip_count > 0);
-		assert(static_cast<size_t>(current_algorithm) < recommendation_algorithms.size());
-
-		if (flip_count() == 0)
-			return 0;
-
-		return recommendation_algorithms.at(static_cast<size_t>(current_algorithm))(*this);
+		return with_recommendation_algorithm(context, [&](auto algorithm) { return decltype(algorithm)::score(*this, context); });
 	}
 
 	u32 avg_stat::flip_count() const
 	{
-		return profit_list.size();
+		return aggregate.flip_count;
 	}
 
 	u32 avg_stat::profitable_flip_count() const
 	{
-		u32 counter{0};
-		for (const i32 p : profit_list)
-			if (p > 0) counter++;
-
-		return counter;
+		return aggregate.profitable_flip_count;
 	}
 
 	u32 avg_stat::cancelled_flip_count() const
 	{
-		return _cancelled_flip_count;
+		return aggregate.cancelled_flip_count;
 	}
 
 	f64 avg_stat::cancellation_ratio() const
 	{
-		return _cancelled_flip_count / static_cast<f64>(_cancelled_flip_count + profit_list.size());
+		return aggregate.cancelled_flip_count / static_cast<f64>(aggregate.cancelled_flip_count + aggregate.flip_count);
 	}
 
 	i32 avg_stat::latest_trade_index() const
 	{
-		return _latest_trade_index;
+		return aggregate.latest_trade_index;
+	}
+
+	std::span<const i64> avg_stat::profits() const
+	{
+		return std::span<const i64>(aggregate.recent_profits.data(), aggregate.recent_count);
 	}
 
-	const std::vector<i32>& avg_stat::profits() const
+	u32 avg_stat::recent_profit_count() const
 	{
-		return profit_list;
+		return aggregate.recent_count;
 	}
 
-	u32 avg_stat::total_flip_count()
+	i64 avg_stat::recent_profit(const u32 age) const
 	{
-		return _total_flip_count;
+		assert(age < recent_profit_count());
+		return aggregate.recent_profits[aggregate.recent_count - 1 - age];
 	}
 
 	TEST_CASE("Average stats per item")
@@ -213,105 +387,293 @@ namespace stats
 		CHECK(statC.flip_count() == 2);
 	}
 
-	void avg_stat::set_recommendation_algorithm(const u8 algorithm)
+	scoring_context::scoring_context()
+	:weights(v2_recommendation_algorithm_weights)
+	{}
+
+	/* Find the value ranges of any list of items that has avg_stat like getters */
+	template<typename stat_list>
+	static void find_value_ranges(scoring_context& context, const stat_list& stats)
 	{
-		switch (algorithm)
+		if (stats.empty())
+			return;
+
+		// figure out the value ranges
+		context.min_avg_profit = stats[0].avg_profit();
+		context.max_avg_profit = stats[0].avg_profit();
+		context.min_avg_buy_limit = stats[0].avg_buy_limit();
+		context.max_avg_buy_limit = stats[0].avg_buy_limit();
+		context.min_avg_roi = stats[0].avg_roi();
+		context.max_avg_roi = stats[0].avg_roi();
+
+		for (u32 i = 0; i < stats.size(); ++i)
+		{
+			const f64 avg_profit = stats[i].avg_profit();
+			const f64 avg_buy_limit = stats[i].avg_buy_limit();
+			const f64 avg_roi = stats[i].avg_roi();
+
+			if (avg_profit < context.min_avg_profit)
+				context.min_avg_profit = avg_profit;
+
+			if (avg_profit > context.max_avg_profit)
+				context.max_avg_profit = avg_profit;
+
+			if (avg_buy_limit < context.min_avg_buy_limit)
+				context.min_avg_buy_limit = avg_buy_limit;
+
+			if (avg_buy_limit > context.max_avg_buy_limit)
+				context.max_avg_buy_limit = avg_buy_limit;
+
+			if (avg_roi < context.min_avg_roi)
+				context.min_avg_roi = avg_roi;
+
+			if (avg_roi > context.max_avg_roi)
+				context.max_avg_roi = avg_roi;
+
+			if (static_cast<u32>(stats[i].latest_trade_index()) > context.total_flip_count)
+				context.total_flip_count = stats[i].latest_trade_index();
+		}
+	}
+
+	scoring_context::scoring_context(const std::vector<avg_stat>& stats)
+	:scoring_context()
+	{
+		find_value_ranges(*this, stats);
+	}
+
+	scoring_context::scoring_context(const avg_stat_table& stats)
+	:scoring_context()
+	{
+		find_value_ranges(*this, stats);
+	}
+
+	void scoring_context::set_algorithm(const u8 version)
+	{
+		switch (version)
 		{
 			case 1:
-				current_algorithm = recommendation_algorithm::v1;
+				algorithm = recommendation_algorithm::v1;
 				break;
 
 			case 2:
-				current_algorithm = recommendation_algorithm::v2;
+				algorithm = recommendation_algorithm::v2;
 				break;
 
 			default:
-				std::cout << "unknown algorithm version: " << algorithm << "\nfalling back to default (" << static_cast<u32>(current_algorithm) << ")\n";
+				std::cout << "unknown algorithm version: " << static_cast<u32>(version) << "\nfalling back to default (" << static_cast<u32>(algorithm) + 1 << ")\n";
 				break;
 		}
 	}
 
-	std::vector<avg_stat> flips_to_avg_stats(const std::vector<nlohmann::json>& flips)
+	TEST_CASE("Scoring context")
 	{
-		std::unordered_map<std::string, avg_stat> avg_stats;
-
-		/* Convert flips into avg stats */
-		for (size_t i = 0; i < flips.size(); i++)
+		const auto make_stats = [](const i64 profit_scale, const u32 first_trade_index)
 		{
-			const flips::flip flip(flips[i]);
-
-			avg_stat& stat = avg_stats[flip.item];
-
-			/* Ignore items that have been cancelled
-			 * do count them though... */
-			if (flip.cancelled == true)
+			std::vector<avg_stat> stats;
+			for (i32 i = 0; i < 20; ++i)
 			{
-				stat.inc_cancel_count();
-				continue;
+				avg_stat stat("Item " + std::to_string(i));
+				for (i32 j = 0; j <= i % 4; ++j)
+					stat.add_data(((i * 7919 + j * 104729) % 2000 - 500) * profit_scale, (i + j) % 11, 100 + i * 37, first_trade_index + i * 4 + j);
+
+				stats.push_back(stat);
 			}
+			return stats;
+		};
 
-			/* Ignore items that haven't sold yet */
-			if (flip.done == false)
-				continue;
-
-			stat.name = flip.item;
-			stat.add_data(
-					margin::calc_profit(flip),
-					stats::calc_roi(flip.buy_price, flip.sold_price),
-					flip.buylimit,
-					i
-				);
-
-			assert(stat.name.empty() == false);
-			assert(stat.flip_count() > 0);
-			assert(stat.avg_buy_limit() > 0);
-
-			/* Highly doubt someone is going to flip the same item
-			 * more than 10 000 000 times */
-			assert(stat.flip_count() < 10'000'000);
-		}
+		const std::vector<avg_stat> small_flips = make_stats(1, 0);
+		const std::vector<avg_stat> big_flips = make_stats(1000, 5000);
 
-		// convert the map into a vector
-		std::vector<avg_stat> result;
-		result.reserve(avg_stats.size());
-		std::transform(avg_stats.begin(), avg_stats.end(), std::back_inserter(result), [](const auto& element) { return element.second; });
+		const scoring_context small_context(small_flips);
+		const scoring_context big_context(big_flips);
 
-		// figure out the value ranges
-		avg_stat::min_avg_profit = result[0].avg_profit();
-		avg_stat::max_avg_profit = result[0].avg_profit();
-		avg_stat::min_avg_buy_limit = result[0].avg_buy_limit();
-		avg_stat::max_avg_buy_limit = result[0].avg_buy_limit();
-		avg_stat::min_avg_roi = result[0].avg_roi();
-		avg_stat::max_avg_roi = result[0].avg_roi();
-
-		for (const avg_stat& avg : result)
+		CHECK(small_context.total_flip_count == 79);
+		CHECK(big_context.total_flip_count == 5079);
+		CHECK(big_context.max_avg_profit > small_context.max_avg_profit);
+		CHECK(small_context.weights == v2_recommendation_algorithm_weights);
+
+		const auto score_all = [](const std::vector<avg_stat>& stats, const scoring_context& context)
 		{
-			const f64 avg_profit = avg.avg_profit();
-			const f64 avg_buy_limit = avg.avg_buy_limit();
-			const f64 avg_roi = avg.avg_roi();
+			std::vector<f64> scores;
+			for (const avg_stat& stat : stats)
+				scores.push_back(stat.flip_recommendation(context));
+			return scores;
+		};
+
+		const std::vector<f64> small_scores = score_all(small_flips, small_context);
+		const std::vector<f64> big_scores = score_all(big_flips, big_context);
+
+		/* Scoring both sets at the same time gives the same results as one after the other */
+		std::vector<f64> concurrent_small_scores;
+		std::vector<f64> concurrent_big_scores;
+		std::thread small_thread([&]() { concurrent_small_scores = score_all(small_flips, small_context); });
+		std::thread big_thread([&]() { concurrent_big_scores = score_all(big_flips, big_context); });
+		small_thread.join();
+		big_thread.join();
+
+		CHECK(concurrent_small_scores == small_scores);
+		CHECK(concurrent_big_scores == big_scores);
+
+		scoring_context v1_context = small_context;
+		v1_context.set_algorithm(1);
+		CHECK(v1_context.algorithm == recommendation_algorithm::v1);
+		CHECK(small_context.algorithm == recommendation_algorithm::v2);
+	}
+
+	const std::string& avg_stat_table::row::name() const
+	{
+		return table.names[index];
+	}
+
+	f64 avg_stat_table::row::flip_recommendation(const scoring_context& context) const
+	{
+		return with_recommendation_algorithm(context, [&](auto algorithm) { return decltype(algorithm)::score(*this, context); });
+	}
+
+	std::span<const i64> avg_stat_table::row::profits() const
+	{
+		return std::span<const i64>(table.recent_profits.data() + table.profit_offsets[index], recent_profit_count());
+	}
+
+	i64 avg_stat_table::row::recent_profit(const u32 age) const
+	{
+		assert(age < recent_profit_count());
+		return table.recent_profits[table.profit_offsets[index + 1] - 1 - age];
+	}
 
-			if (avg_profit < avg_stat::min_avg_profit)
-				avg_stat::min_avg_profit = avg_profit;
+	avg_stat_table::avg_stat_table(const std::vector<avg_stat>& stats)
+	{
+		reserve(stats.size());
 
-			if (avg_profit > avg_stat::max_avg_profit)
-				avg_stat::max_avg_profit = avg_profit;
+		for (const avg_stat& stat : stats)
+			add(stat.name, stat.aggregate);
+	}
 
-			if (avg_buy_limit < avg_stat::min_avg_buy_limit)
-				avg_stat::min_avg_buy_limit = avg_buy_limit;
+	void avg_stat_table::reserve(const size_t item_count)
+	{
+		names.reserve(item_count);
+		total_profits.reserve(item_count);
+		total_item_counts.reserve(item_count);
+		total_rois.reserve(item_count);
+		profit_m2s.reserve(item_count);
+		flip_counts.reserve(item_count);
+		profitable_flip_counts.reserve(item_count);
+		cancelled_flip_counts.reserve(item_count);
+		latest_trade_indices.reserve(item_count);
+		profit_offsets.reserve(item_count + 1);
+	}
 
-			if (avg_buy_limit > avg_stat::max_avg_buy_limit)
-				avg_stat::max_avg_buy_limit = avg_buy_limit;
+	void avg_stat_table::add(const std::string& name, const item_aggregate& aggregate)
+	{
+		names.push_back(name);
+		total_profits.push_back(aggregate.total_profit);
+		total_item_counts.push_back(aggregate.total_item_count);
+		total_rois.push_back(aggregate.total_roi);
+		profit_m2s.push_back(aggregate.profit_m2);
+		flip_counts.push_back(aggregate.flip_count);
+		profitable_flip_counts.push_back(aggregate.profitable_flip_count);
+		cancelled_flip_counts.push_back(aggregate.cancelled_flip_count);
+		latest_trade_indices.push_back(aggregate.latest_trade_index);
+
+		recent_profit_totals.push_back(0);
+		for (u32 i = 0; i < aggregate.recent_count; ++i)
+		{
+			recent_profits.push_back(aggregate.recent_profits[i]);
+			recent_profit_totals.push_back(recent_profit_totals.back() + aggregate.recent_profits[i]);
+		}
 
-			if (avg_roi < avg_stat::min_avg_roi)
-				avg_stat::min_avg_roi = avg_roi;
+		profit_offsets.push_back(recent_profits.size());
+	}
 
-			if (avg_roi > avg_stat::max_avg_roi)
-				avg_stat::max_avg_roi = avg_roi;
+	avg_stat_table avg_stat_table::subset(const std::vector<u32>& indices) const
+	{
+		avg_stat_table result;
+		result.reserve(indices.size());
+
+		for (const u32 i : indices)
+		{
+			assert(i < size());
+
+			result.names.push_back(names[i]);
+			result.total_profits.push_back(total_profits[i]);
+			result.total_item_counts.push_back(total_item_counts[i]);
+			result.total_rois.push_back(total_rois[i]);
+			result.profit_m2s.push_back(profit_m2s[i]);
+			result.flip_counts.push_back(flip_counts[i]);
+			result.profitable_flip_counts.push_back(profitable_flip_counts[i]);
+			result.cancelled_flip_counts.push_back(cancelled_flip_counts[i]);
+			result.latest_trade_indices.push_back(latest_trade_indices[i]);
+
+			result.recent_profits.insert(result.recent_profits.end(), recent_profits.begin() + profit_offsets[i], recent_profits.begin() + profit_offsets[i + 1]);
+			result.recent_profit_totals.insert(result.recent_profit_totals.end(),
+					recent_profit_totals.begin() + profit_offsets[i] + i,
+					recent_profit_totals.begin() + profit_offsets[i + 1] + i + 1);
+			result.profit_offsets.push_back(result.recent_profits.size());
 		}
 
 		return result;
 	}
 
+	TEST_CASE("Avgstat table")
+	{
+		std::vector<avg_stat> stats;
+		for (i32 i = 0; i < 25; ++i)
+		{
+			avg_stat stat("Item " + std::to_string(i));
+			for (i32 j = 0; j < i; ++j)
+				stat.add_data((i * 7919 + j * 104729) % 20000 - 5000, (i + j) % 13, 100 + i * j, i * 30 + j);
+
+			for (i32 j = 0; j < i % 4; ++j)
+				stat.inc_cancel_count();
+
+			stats.push_back(stat);
+		}
+
+		const avg_stat_table table(stats);
+		REQUIRE(table.size() == stats.size());
+
+		scoring_context context(stats);
+		CHECK(scoring_context(table).max_avg_profit == context.max_avg_profit);
+		CHECK(scoring_context(table).total_flip_count == context.total_flip_count);
+
+		const auto check_row = [&context](const avg_stat_table::row& row, const avg_stat& stat)
+		{
+			CHECK(row.name() == stat.name);
+			CHECK(row.flip_count() == stat.flip_count());
+			CHECK(row.profitable_flip_count() == stat.profitable_flip_count());
+			CHECK(row.cancelled_flip_count() == stat.cancelled_flip_count());
+			CHECK(row.latest_trade_index() == stat.latest_trade_index());
+			CHECK(row.avg_profit() == stat.avg_profit());
+			CHECK(row.avg_roi() == stat.avg_roi());
+			CHECK(row.avg_buy_limit() == stat.avg_buy_limit());
+			CHECK(std::equal(row.profits().begin(), row.profits().end(), stat.profits().begin(), stat.profits().end()));
+
+			if (stat.flip_count() == 0)
+				return;
+
+			CHECK(row.cancellation_ratio() == stat.cancellation_ratio());
+			CHECK(row.profit_standard_deviation() == stat.profit_standard_deviation());
+			CHECK(row.recent_profit(0) == stat.recent_profit(0));
+
+			for (const u32 window : { 1, 5, 10, 15 })
+				CHECK(row.rolling_avg_profit(window) == stat.rolling_avg_profit(window));
+
+			context.algorithm = recommendation_algorithm::v1;
+			CHECK(row.flip_recommendation(context) == stat.flip_recommendation(context));
+			context.algorithm = recommendation_algorithm::v2;
+			CHECK(row.flip_recommendation(context) == stat.flip_recommendation(context));
+		};
+
+		for (u32 i = 0; i < table.size(); ++i)
+			check_row(table[i], stats[i]);
+
+		const std::vector<u32> indices = { 24, 3, 0, 17, 17 };
+		const avg_stat_table subset = table.subset(indices);
+		REQUIRE(subset.size() == indices.size());
+		for (u32 i = 0; i < subset.size(); ++i)
+			check_row(subset[i], stats[indices[i]]);
+	}
+
 	TEST_CASE("Convert flips to avgstats")
 	{
 		std::vector<nlohmann::json> json;
@@ -346,10 +708,75 @@ namespace stats
 		data_point_C["cancelled"] = false;
 		json.push_back(data_point_C);
 
-		std::vector<avg_stat> avg_stats = flips_to_avg_stats(json);
+		nlohmann::json db_json;
+		db_json["flips"] = json;
+		db db(db_json);
+		db.rebuild_item_stats();
+
+		const std::vector<avg_stat> avg_stats = db.get_flip_avg_stats();
 
 		CHECK(avg_stats.size() == 1);
 		CHECK(avg_stats[0].name == "Test item");
 		CHECK(avg_stats[0].flip_count() == 2);
 	}
+
+	TEST_CASE("Parallel item stats rebuild")
+	{
+		std::vector<nlohmann::json> json;
+		for (i32 i = 0; i < 20000; ++i)
+		{
+			const i32 buy = 100 + (i * 7919) % 50000;
+			nlohmann::json flip;
+			flip["item"] = "Item " + std::to_string((i * 31) % 97);
+			flip["buy"] = buy;
+			flip["sell"] = buy + 100;
+			flip["sold"] = buy - 500 + (i * 104729) % 1700;
+			flip["limit"] = 1 + (i * 13) % 25000;
+			flip["cancelled"] = i % 11 == 0;
+			flip["done"] = i % 11 != 0 && i % 13 != 0;
+			json.push_back(flip);
+		}
+
+		/* Add the flips to the stats of their items one by one */
+		std::vector<avg_stat> serial;
+		for (u32 i = 0; i < json.size(); ++i)
+		{
+			const nlohmann::json& flip = json[i];
+			auto stat = std::find_if(serial.begin(), serial.end(), [&flip](const avg_stat& stat) { return stat.name == flip["item"]; });
+			if (stat == serial.end())
+				stat = serial.emplace(serial.end(), flip["item"].get<std::string>());
+
+			if (flip["cancelled"])
+				stat->inc_cancel_count();
+			else if (flip["done"])
+				stat->add_data(margin::calc_profit(flip["buy"], flip["sold"], flip["limit"]), calc_roi(flip), flip["limit"], i);
+		}
+
+		/* Items that have only been cancelled don't have any data to work with */
+		std::erase_if(serial, [](const avg_stat& stat) { return stat.flip_count() == 0; });
+		REQUIRE(serial.size() == 97);
+
+		nlohmann::json db_json;
+		db_json["stats"]["flips_done"] = 0;
+		db_json["stats"]["profit"] = 0;
+		db_json["flips"] = json;
+		db db(db_json);
+
+		/* The parallel rebuild goes through the flips of each item in the same order */
+		db.rebuild_item_stats();
+		const std::vector<avg_stat> rebuilt = db.get_flip_avg_stats();
+
+		REQUIRE(rebuilt.size() == serial.size());
+		for (size_t i = 0; i < serial.size(); ++i)
+		{
+			CHECK(rebuilt[i].name == serial[i].name);
+			CHECK(rebuilt[i].flip_count() == serial[i].flip_count());
+			CHECK(rebuilt[i].cancelled_flip_count() == serial[i].cancelled_flip_count());
+			CHECK(rebuilt[i].latest_trade_index() == serial[i].latest_trade_index());
+			CHECK(rebuilt[i].avg_profit() == serial[i].avg_profit());
+			CHECK(rebuilt[i].avg_roi() == serial[i].avg_roi());
+			CHECK(rebuilt[i].profit_standard_deviation() == serial[i].profit_standard_deviation());
+			CHECK(std::equal(rebuilt[i].profits().begin(), rebuilt[i].profits().end(), serial[i].profits().begin(), serial[i].profits().end()));
+		}
+	}
 }
@@ -0,0 +1,177 @@
+#include "AvgStat.hpp"
+#include "Benchmark.hpp"
+#include "FlipUtils.hpp"
+#include "Random.hpp"
+#include "Recommendations.hpp"
+#include "Stats.hpp"
+#include "Table.hpp"
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace benchmark
+{
+	/* Items with a random flipping history */
+	static std::vector<stats::avg_stat> generate_avg_stats(const u32 item_count, class random& rng)
+	{
+		std::vector<stats::avg_stat> result;
+		result.reserve(item_count);
+
+		u32 trade_index{0};
+		for (u32 i = 0; i < item_count; ++i)
+		{
+			stats::avg_stat stat("Item " + std::to_string(i));
+
+			const u32 flip_count = rng.range(4, 40);
+			for (u32 j = 0; j < flip_count; ++j)
+			{
+				const i32 buy_price = rng.range(10, 100'000);
+				const i32 sell_price = buy_price * rng.range_float(0.95, 1.15);
+				const i32 item_count = rng.range(100, 25'000);
+
+				stat.add_data(static_cast<i64>(sell_price - buy_price) * item_count, stats::calc_roi(buy_price, sell_price), item_count, trade_index++);
+			}
+
+			for (u32 j = rng.range(0, 3); j > 0; --j)
+				stat.inc_cancel_count();
+
+			result.push_back(stat);
+		}
+
+		return result;
+	}
+
+	/* Run the function repeatedly for about a second and return the iterations per second */
+	template<typename F>
+	static f64 iterations_per_second(F&& function)
+	{
+		using clock = std::chrono::steady_clock;
+		constexpr f64 duration = 1.0;
+
+		const clock::time_point start = clock::now();
+		u64 iterations{0};
+		f64 elapsed{0};
+
+		do
+		{
+			function();
+			++iterations;
+			elapsed = std::chrono::duration<f64>(clock::now() - start).count();
+		} while (elapsed < duration);
+
+		return iterations / elapsed;
+	}
+
+	static std::string format_rate(const f64 rate)
+	{
+		std::stringstream stream;
+		stream << std::fixed << std::setprecision(1) << rate;
+		return stream.str();
+	}
+
+	static void v2_optimizer_ranking(class random& rng)
+	{
+		constexpr u32 item_count = 2000;
+		constexpr size_t top_flip_count = 50;
+
+		flip_utils::print_title("v2 optimizer ranking, " + std::to_string(item_count) + " items");
+
+		std::vector<stats::avg_stat> flips = generate_avg_stats(item_count, rng);
+		const stats::avg_stat_table stat_table(flips);
+		const stats::scoring_context context(stat_table);
+
+		/* Score and sort the item stats on every iteration */
+		const f64 scored_sort = iterations_per_second([&flips, &context]() {
+			stats::sort_flips_by_recommendation_direct(flips, context);
+		});
+
+		/* Score the columns and sort the indices */
+		const f64 table_ranking = iterations_per_second([&stat_table, &context]() {
+			const std::vector<u32> ranking = stats::rank_flips_by_recommendation(stat_table, context, top_flip_count);
+		});
+
+		const v2_feature_matrix feature_matrix(stat_table, context);
+		std::vector<f64> scores;
+		std::vector<u32> ranking;
+
+		const f64 matrix_product = iterations_per_second([&]() {
+			feature_matrix.rank(context.weights, scores, ranking, top_flip_count);
+		});
+
+		table results({"Method", "Iterations/s"});
+		results.add_row({"Sort the item stats", format_rate(scored_sort)});
+		results.add_row({"Rank the stat table", format_rate(table_ranking)});
+		results.add_row({"Feature matrix product", format_rate(matrix_product)});
+
+		/* Score with each instruction set the CPU supports */
+		for (const v2_feature_matrix::instruction_set set : { v2_feature_matrix::instruction_set::scalar, v2_feature_matrix::instruction_set::avx2, v2_feature_matrix::instruction_set::avx512 })
+		{
+			if (!v2_feature_matrix::is_supported(set))
+				continue;
+
+			const f64 score_rate = iterations_per_second([&]() {
+				feature_matrix.score(context.weights, scores, set);
+			});
+
+			results.add_row({"Score the items (" + v2_feature_matrix::instruction_set_name(set) + ")", format_rate(score_rate)});
+		}
+		results.print();
+
+		std::cout << "Speedup: " << format_rate(matrix_product / scored_sort) << "x\n";
+	}
+
+	static void recommendation_dispatch(class random& rng)
+	{
+		constexpr u32 item_count = 50'000;
+
+		flip_utils::print_title("Recommendation algorithm dispatch, " + std::to_string(item_count) + " items");
+
+		const stats::avg_stat_table stat_table(generate_avg_stats(item_count, rng));
+		stats::scoring_context context(stat_table);
+		std::vector<f64> scores(stat_table.size());
+
+		/* The algorithm is looked up from a table of std::functions for every item */
+		const std::array<std::function<f64(const stats::avg_stat_table::row&, const stats::scoring_context&)>, 2> algorithm_functions = {
+			[](const stats::avg_stat_table::row& stat, const stats::scoring_context& context) { return v1_algorithm::score(stat, context); },
+			[](const stats::avg_stat_table::row& stat, const stats::scoring_context& context) { return v2_algorithm::score(stat, context); }
+		};
+
+		table results({"Algorithm", "std::function table (items/s)", "Template dispatch (items/s)"});
+
+		for (const u8 version : { 1, 2 })
+		{
+			context.set_algorithm(version);
+
+			const f64 function_table = iterations_per_second([&]() {
+				for (size_t i = 0; i < stat_table.size(); ++i)
+					scores[i] = algorithm_functions.at(static_cast<size_t>(context.algorithm))(stat_table[i], context);
+			});
+
+			/* The algorithm is picked once and the loop is instantiated for it */
+			const f64 template_dispatch = iterations_per_second([&]() {
+				with_recommendation_algorithm(context, [&](auto algorithm) {
+					for (size_t i = 0; i < stat_table.size(); ++i)
+						scores[i] = decltype(algorithm)::score(stat_table[i], context);
+				});
+			});
+
+			results.add_row({"v" + std::to_string(version), format_rate(function_table * item_count), format_rate(template_dispatch * item_count)});
+		}
+
+		results.print();
+	}
+
+	void run()
+	{
+		/* Same data on every run */
+		class random rng;
+		rng.seed(1337);
+
+		v2_optimizer_ranking(rng);
+		recommendation_dispatch(rng);
+	}
+}
@@ -2,14 +2,18 @@
 #include "FilePaths.hpp"
 #include "FlipUtils.hpp"
 #include "Flips.hpp"
+#include "Margin.hpp"
+#include "Stats.hpp"
 
 #include <assert.h>
 #include <doctest/doctest.h>
+#include <execution>
 #include <filesystem>
 #include <iostream>
 #include <sys/types.h>
 
-constexpr char DEFAULT_DATA_FILE[] = "{\"stats\":{\"profit\":0,\"flips_done\":0},\"flips\":[]}\n";
+/* Rewrite the data file once the operation log grows past this size */
+constexpr size_t CHECKPOINT_LOG_SIZE = 256 * 1024;
 
 db::db()
 {
@@ -19,39 +23,213 @@ db::db()
 	if (!std::filesystem::exists(file_paths::data_path))
 		std::filesystem::create_directories(file_paths::data_path);
 
+	operation_log.emplace(file_paths::op_log_file);
+
+	/* Convert the old json database if there is one lying around */
+	if (!std::filesystem::exists(file_paths::data_file) && std::filesystem::exists(file_paths::legacy_data_file))
+		migrate_json_data_file();
+
 	if (!std::filesystem::exists(file_paths::data_file))
-		create_default_data_file();
+		checkpoint();
 
-	/* Read the json data file */
-	const std::string json_string = flip_utils::read_file(file_paths::data_file);
+	/* Read the whole data file in one go */
+	const std::string data = flip_utils::read_file(file_paths::data_file);
 
-	try
-	{
-		json_data = nlohmann::json::parse(json_string);
-	}
-	catch (const std::exception& e)
+	if (!flip_store::deserialize(data, store))
 	{
-		std::cout << "The database is possibly corrupted. Restore a backup to proceed.\nError: " << e.what() << '\n';
+		std::cout << "The database is possibly corrupted. Restore a backup to proceed.\n";
 		exit(1);
 	}
 
-	/* Validate the database before using it to avoid nuking any backups on write
-	 * if there's still one around */
+	rebuild_indices();
 
-	if (!validate(json_data))
+	/* Files from before the item stats were stored or with an older layout of them don't have them */
+	if (store.item_stats.empty() && store.items.size() != 0)
+		calculate_item_stats();
+
+	/* Apply the changes that haven't been checkpointed into the data file yet */
+	for (const std::string& record : operation_log->open(store.generation))
 	{
-		std::cout << "The json database is missing information. Restore a backup to proceed\n";
-		exit(1);
+		if (!replay(record))
+		{
+			std::cout << "The operation log " << file_paths::op_log_file << " doesn't match the database. Restore a backup to proceed.\n";
+			exit(1);
+		}
 	}
 }
 
 db::db(const nlohmann::json& json_data)
-:json_data(json_data)
-{}
+{
+	load_json(json_data);
+}
 
 void db::add_flip(const flips::flip& flip)
 {
-	json_data["flips"].emplace_back(flip.to_json());
+	store_flip(flip);
+
+	if (!operation_log)
+		return;
+
+	op_log::record record;
+	record.put(log_op::add_flip);
+	record.put(flip.account);
+	record.put(flip.item);
+	record.put<i32>(flip.buy_price);
+	record.put<i32>(flip.sell_price);
+	record.put<i32>(flip.sold_price);
+	record.put<i32>(flip.buylimit);
+	record.put<u8>(flip.cancelled);
+	record.put<u8>(flip.done);
+	operation_log->stage(record);
+}
+
+void db::import_flip(const flips::flip& flip)
+{
+	store_flip(flip);
+
+	if (operation_log)
+		checkpoint_needed = true;
+}
+
+void db::store_flip(const flips::flip& flip)
+{
+	/* If the account value is empty, default it to "main" */
+	store.account.push_back(store.accounts.intern(flip.account.empty() ? "main" : flip.account));
+	store.item.push_back(store.items.intern(flip.item));
+	store.buy.push_back(flip.buy_price);
+	store.sell.push_back(flip.sell_price);
+	store.sold.push_back(flip.sold_price);
+	store.limit.push_back(flip.buylimit);
+	store.cancelled.push_back(flip.cancelled);
+	store.done.push_back(flip.done);
+
+	/* New flips always have the largest index */
+	if (!flip.done && !flip.cancelled)
+		open_flips.push_back(store.size() - 1);
+
+	index_item_flip(store.size() - 1);
+	aggregate_flip(store.size() - 1);
+}
+
+void db::aggregate_flip(const u32 index)
+{
+	const u32 item_id = store.item[index];
+	if (store.item_stats.size() <= item_id)
+		store.item_stats.resize(store.items.size());
+
+	aggregate_flip(index, store.item_stats[item_id]);
+}
+
+void db::aggregate_flip(const u32 index, stats::item_aggregate& aggregate) const
+{
+	/* Cancelled flips are only counted */
+	if (store.cancelled[index])
+	{
+		aggregate.add_cancel();
+		return;
+	}
+
+	/* Flips that haven't sold yet have no stats */
+	if (!store.done[index])
+		return;
+
+	aggregate.add_flip(
+			margin::calc_profit(store.buy[index], store.sold[index], store.limit[index]),
+			stats::calc_roi(store.buy[index], store.sold[index]),
+			store.limit[index],
+			index
+		);
+}
+
+void db::calculate_item_stats()
+{
+	store.item_stats.clear();
+	store.item_stats.resize(store.items.size());
+
+	/* Every item is aggregated from its own flips in the order of the flips,
+	 * so the items can be done in parallel and the results are the same as
+	 * when the flips are added one by one */
+	std::vector<u32> item_ids(item_flips.size());
+	std::iota(item_ids.begin(), item_ids.end(), 0);
+
+	std::for_each(std::execution::par, item_ids.begin(), item_ids.end(), [this](const u32 item_id) {
+		for (const u32 i : item_flips[item_id])
+			aggregate_flip(i, store.item_stats[item_id]);
+	});
+}
+
+void db::rebuild_indices()
+{
+	open_flips.clear();
+	item_flips.clear();
+	item_names.clear();
+
+	for (u32 i = 0; i < total_flip_count(); ++i)
+	{
+		if (!store.done[i] && !store.cancelled[i])
+			open_flips.push_back(i);
+
+		index_item_flip(i);
+	}
+}
+
+void db::index_item_flip(const u32 index)
+{
+	const u32 item_id = store.item[index];
+
+	/* Register new items to the name index */
+	while (item_flips.size() <= item_id)
+	{
+		const u32 new_id = item_flips.size();
+		item_flips.emplace_back();
+
+		const std::string name = flip_utils::str_to_lower(store.items.at(new_id));
+		const auto it = std::lower_bound(item_names.begin(), item_names.end(), name, [](const auto& entry, const std::string& name) {
+			return entry.first < name;
+		});
+
+		if (it != item_names.end() && it->first == name)
+			it->second.push_back(new_id);
+		else
+			item_names.insert(it, { name, { new_id } });
+	}
+
+	/* Flips are usually indexed in order, so this is an append */
+	std::vector<u32>& flips = item_flips[item_id];
+	flips.insert(std::upper_bound(flips.begin(), flips.end(), index), index);
+}
+
+void db::change_flip_item(const u32 index, const u32 item_id)
+{
+	std::vector<u32>& old_flips = item_flips[store.item[index]];
+	old_flips.erase(std::lower_bound(old_flips.begin(), old_flips.end(), index));
+
+	store.item[index] = item_id;
+	index_item_flip(index);
+}
+
+const std::vector<u32>* db::find_item_ids(const std::string& item_name_lowercase) const
+{
+	const auto it = std::lower_bound(item_names.begin(), item_names.end(), item_name_lowercase, [](const auto& entry, const std::string& name) {
+		return entry.first < name;
+	});
+
+	if (it == item_names.end() || it->first != item_name_lowercase)
+		return nullptr;
+
+	return &it->second;
+}
+
+void db::update_open_flip(const u32 index)
+{
+	const bool open = !store.done[index] && !store.cancelled[index];
+	const auto it = std::lower_bound(open_flips.begin(), open_flips.end(), index);
+	const bool listed = it != open_flips.end() && *it == index;
+
+	if (open && !listed)
+		open_flips.insert(it, index);
+	else if (!open && listed)
+		open_flips.erase(it);
 }
 
 TEST_CASE("Add a new flip")
@@ -73,44 +251,358 @@ TEST_CASE("Add a new flip")
 	CHECK(db.total_flip_count() == 0);
 	db.add_flip(flip_a);
 	CHECK(db.total_flip_count() == 1);
+
+	db.set_flip<db::flip_key::limit>(0, 100);
+	db.set_flip<db::flip_key::account>(0, "alt1");
+	CHECK(db.get_flip<db::flip_key::limit>(0) == 100);
+	CHECK(db.get_flip<db::flip_key::account>(0) == "alt1");
+	CHECK(db.get_flip<db::flip_key::item>(0) == flip_a.item);
 }
 
 size_t db::total_flip_count() const
 {
-	return json_data.contains("flips") ? json_data["flips"].size() : 0;
+	return store.size();
 }
 
 flips::flip db::get_flip_obj(const u32 index) const
 {
-	return flips::flip(json_data["flips"].at(index));
+	assert(index < total_flip_count());
+
+	flips::flip flip;
+	flip.item		= get_flip<flip_key::item>(index);
+	flip.buy_price	= get_flip<flip_key::buy>(index);
+	flip.sell_price	= get_flip<flip_key::sell>(index);
+	flip.sold_price	= get_flip<flip_key::sold>(index);
+	flip.buylimit	= get_flip<flip_key::limit>(index);
+	flip.cancelled	= get_flip<flip_key::cancelled>(index);
+	flip.done		= get_flip<flip_key::done>(index);
+	flip.account	= get_flip<flip_key::account>(index);
+
+	return flip;
+}
+
+const std::vector<u32>& db::open_flip_indices() const
+{
+	return open_flips;
+}
+
+TEST_CASE("Open flip index")
+{
+	db db(nlohmann::json{});
+
+	for (i32 i = 0; i < 5; ++i)
+		db.add_flip(flips::flip("Item " + std::to_string(i), 100, 120, 1000));
+
+	CHECK(db.open_flip_indices() == std::vector<u32>{ 0, 1, 2, 3, 4 });
+
+	db.set_flip<db::flip_key::done>(1, true);
+	db.set_flip<db::flip_key::cancelled>(3, true);
+	CHECK(db.open_flip_indices() == std::vector<u32>{ 0, 2, 4 });
+
+	/* The runtime setter keeps the index up-to-date too */
+	db.set_flip(2, db::flip_key::done, true);
+	CHECK(db.open_flip_indices() == std::vector<u32>{ 0, 4 });
+
+	/* Re-opening a flip puts it back to its original position */
+	db.set_flip<db::flip_key::cancelled>(3, false);
+	CHECK(db.open_flip_indices() == std::vector<u32>{ 0, 3, 4 });
+
+	flips::flip finished("Finished item", 100, 120, 1000);
+	finished.done = true;
+	db.add_flip(finished);
+	db.add_flip(flips::flip("Item 6", 100, 120, 1000));
+	CHECK(db.open_flip_indices() == std::vector<u32>{ 0, 3, 4, 6 });
 }
 
 std::vector<stats::avg_stat> db::get_flip_avg_stats() const
 {
-	return stats::flips_to_avg_stats(json_data["flips"]);
+	std::vector<stats::avg_stat> result;
+
+	/* Items that have only been cancelled don't have any data to work with */
+	for (u32 item_id = 0; item_id < store.item_stats.size(); ++item_id)
+	{
+		if (store.item_stats[item_id].flip_count > 0)
+			result.emplace_back(store.items.at(item_id), store.item_stats[item_id]);
+	}
+
+	return result;
+}
+
+stats::avg_stat_table db::get_flip_stat_table() const
+{
+	stats::avg_stat_table result;
+	result.reserve(store.item_stats.size());
+
+	for (u32 item_id = 0; item_id < store.item_stats.size(); ++item_id)
+	{
+		if (store.item_stats[item_id].flip_count > 0)
+			result.add(store.items.at(item_id), store.item_stats[item_id]);
+	}
+
+	return result;
+}
+
+void db::add_to_item_stats(const u32 index)
+{
+	assert(index < total_flip_count());
+	aggregate_flip(index);
+
+	if (!operation_log)
+		return;
+
+	op_log::record record;
+	record.put(log_op::add_to_item_stats);
+	record.put(index);
+	operation_log->stage(record);
+}
+
+void db::rebuild_item_stats()
+{
+	calculate_item_stats();
+
+	if (!operation_log)
+		return;
+
+	op_log::record record;
+	record.put(log_op::rebuild_item_stats);
+	operation_log->stage(record);
+}
+
+TEST_CASE("Item stats")
+{
+	db db(nlohmann::json{});
+
+	for (i32 i = 0; i < 40; ++i)
+		db.add_flip(flips::flip(i % 3 == 0 ? "Iron bar" : "Tomato", 1000 + i, 1200, 100 + i));
+
+	/* Finish the flips out of order. Every fifth one gets cancelled */
+	for (i32 i = 39; i >= 0; --i)
+	{
+		const u32 index = (i * 7) % 40;
+		if (index % 5 == 0)
+		{
+			db.set_flip<db::flip_key::cancelled>(index, true);
+		}
+		else
+		{
+			db.set_flip<db::flip_key::done>(index, true);
+			db.set_flip<db::flip_key::sold>(index, 1100 + index * 3);
+		}
+		db.add_to_item_stats(index);
+	}
+
+	const auto check_against_full_recalculation = [&db]()
+	{
+		std::vector<stats::avg_stat> incremental = db.get_flip_avg_stats();
+
+		/* Add every flip to the stats of its item one by one */
+		std::vector<stats::avg_stat> recalculated;
+		for (u32 i = 0; i < db.total_flip_count(); ++i)
+		{
+			const std::string& item = db.get_flip<db::flip_key::item>(i);
+			auto stat = std::find_if(recalculated.begin(), recalculated.end(), [&item](const stats::avg_stat& stat) { return stat.name == item; });
+			if (stat == recalculated.end())
+				stat = recalculated.emplace(recalculated.end(), item);
+
+			const i32 buy = db.get_flip<db::flip_key::buy>(i);
+			const i32 sold = db.get_flip<db::flip_key::sold>(i);
+			const i32 limit = db.get_flip<db::flip_key::limit>(i);
+
+			if (db.get_flip<db::flip_key::cancelled>(i))
+				stat->inc_cancel_count();
+			else if (db.get_flip<db::flip_key::done>(i))
+				stat->add_data(margin::calc_profit(buy, sold, limit), stats::calc_roi(buy, sold), limit, i);
+		}
+		std::erase_if(recalculated, [](const stats::avg_stat& stat) { return stat.flip_count() == 0; });
+
+		REQUIRE(incremental.size() == recalculated.size());
+
+		const auto by_name = [](const stats::avg_stat& a, const stats::avg_stat& b) { return a.name < b.name; };
+		std::sort(incremental.begin(), incremental.end(), by_name);
+		std::sort(recalculated.begin(), recalculated.end(), by_name);
+
+		for (size_t i = 0; i < incremental.size(); ++i)
+		{
+			CHECK(incremental[i].name == recalculated[i].name);
+			CHECK(incremental[i].flip_count() == recalculated[i].flip_count());
+			CHECK(incremental[i].profitable_flip_count() == recalculated[i].profitable_flip_count());
+			CHECK(incremental[i].cancelled_flip_count() == recalculated[i].cancelled_flip_count());
+			CHECK(incremental[i].latest_trade_index() == recalculated[i].latest_trade_index());
+			CHECK(incremental[i].avg_profit() == recalculated[i].avg_profit());
+			CHECK(incremental[i].avg_buy_limit() == recalculated[i].avg_buy_limit());
+			CHECK(incremental[i].avg_roi() == doctest::Approx(recalculated[i].avg_roi()));
+			CHECK(incremental[i].profit_standard_deviation() == doctest::Approx(recalculated[i].profit_standard_deviation()));
+			CHECK(incremental[i].min_profit() == recalculated[i].min_profit());
+			CHECK(incremental[i].max_profit() == recalculated[i].max_profit());
+			CHECK(std::equal(incremental[i].profits().begin(), incremental[i].profits().end(),
+						recalculated[i].profits().begin(), recalculated[i].profits().end()));
+		}
+	};
+
+	SUBCASE("Incremental updates match a full recalculation")
+	{
+		check_against_full_recalculation();
+	}
+
+	SUBCASE("Rebuilding after modifying finished flips")
+	{
+		db.set_flip<db::flip_key::sold>(1, 5000);
+		db.set_flip<db::flip_key::done>(2, false);
+		db.set_flip<db::flip_key::cancelled>(2, true);
+		db.rebuild_item_stats();
+		check_against_full_recalculation();
+	}
+
+	SUBCASE("Filter by flip count")
+	{
+		db.add_flip(flips::flip("Steel bar", 500, 600, 1000));
+		flips::flip mithril_bar("Mithril bar", 500, 600, 1000);
+		mithril_bar.sold_price = 600;
+		mithril_bar.done = true;
+		db.add_flip(mithril_bar);
+
+		db.set_stat(db::stat_key::flips_done, 33);
+		CHECK(db.find_flips_by_count(1) == std::vector<u32>{ 41 });
+		CHECK(db.find_flips_by_count(20).size() == 2);
+	}
+}
+
+TEST_CASE("Item stats from a full recalculation")
+{
+	db db(nlohmann::json{});
+
+	for (i32 i = 0; i < 20000; ++i)
+	{
+		flips::flip flip("Item " + std::to_string((i * 31) % 211), 100 + (i * 7919) % 50000, 0, 1 + (i * 13) % 25000);
+		flip.sold_price = flip.buy_price - 500 + (i * 104729) % 1700;
+		flip.cancelled = i % 11 == 0;
+		flip.done = i % 11 != 0 && i % 13 != 0;
+		db.add_flip(flip);
+	}
+
+	const std::vector<stats::avg_stat> incremental = db.get_flip_avg_stats();
+	db.rebuild_item_stats();
+	const std::vector<stats::avg_stat> rebuilt = db.get_flip_avg_stats();
+
+	/* The parallel rebuild adds the flips of each item in the same order, so the results are exactly the same */
+	REQUIRE(incremental.size() == rebuilt.size());
+	for (size_t i = 0; i < incremental.size(); ++i)
+	{
+		CHECK(incremental[i].name == rebuilt[i].name);
+		CHECK(incremental[i].flip_count() == rebuilt[i].flip_count());
+		CHECK(incremental[i].cancelled_flip_count() == rebuilt[i].cancelled_flip_count());
+		CHECK(incremental[i].latest_trade_index() == rebuilt[i].latest_trade_index());
+		CHECK(incremental[i].avg_profit() == rebuilt[i].avg_profit());
+		CHECK(incremental[i].avg_roi() == rebuilt[i].avg_roi());
+		CHECK(incremental[i].profit_standard_deviation() == rebuilt[i].profit_standard_deviation());
+		CHECK(std::equal(incremental[i].profits().begin(), incremental[i].profits().end(),
+					rebuilt[i].profits().begin(), rebuilt[i].profits().end()));
+	}
 }
 
 std::vector<u32> db::find_flips_by_name(const std::string& item_name) const
 {
 	std::vector<u32> result;
-	const std::string item_name_lowercase = flip_utils::str_to_lower(item_name);
 
 	/* Quit if zero flips done */
 	if (get_stat(stat_key::flips_done) == 0)
 		return result;
 
-	for (u32 i = 0; i < total_flip_count(); ++i)
+	const std::vector<u32>* item_ids = find_item_ids(flip_utils::str_to_lower(item_name));
+	if (item_ids == nullptr)
+		return result;
+
+	for (const u32 item_id : *item_ids)
+	{
+		for (const u32 i : item_flips[item_id])
+		{
+			if (get_flip<flip_key::done>(i))
+				result.emplace_back(i);
+		}
+	}
+
+	/* Differently cased names need to be merged back into the original order */
+	if (item_ids->size() > 1)
+		std::sort(result.begin(), result.end());
+
+	return result;
+}
+
+std::vector<std::string> db::search_items(const std::string& query) const
+{
+	std::vector<std::string> result;
+	const std::string query_lowercase = flip_utils::str_to_lower(query);
+
+	if (query_lowercase.empty())
+		return result;
+
+	/* Names starting with the query are next to each other in the sorted index */
+	const auto first_match = std::lower_bound(item_names.begin(), item_names.end(), query_lowercase, [](const auto& entry, const std::string& name) {
+		return entry.first < name;
+	});
+
+	auto prefix_end = first_match;
+	while (prefix_end != item_names.end() && prefix_end->first.starts_with(query_lowercase))
 	{
-		if (flip_utils::str_to_lower(get_flip<std::string>(i, flip_key::item)) != item_name_lowercase)
+		result.push_back(store.items.at(prefix_end->second.front()));
+		++prefix_end;
+	}
+
+	/* The rest of the names need to be checked one by one */
+	for (auto it = item_names.begin(); it != item_names.end(); ++it)
+	{
+		if (it >= first_match && it < prefix_end)
 			continue;
 
-		if (get_flip<bool>(i, flip_key::done))
-			result.emplace_back(i);
+		if (it->first.find(query_lowercase) != std::string::npos)
+			result.push_back(store.items.at(it->second.front()));
 	}
 
 	return result;
 }
 
+TEST_CASE("Item name index")
+{
+	db db(nlohmann::json{});
+
+	const auto add_done_flip = [&db](const std::string& item)
+	{
+		flips::flip flip(item, 100, 120, 1000);
+		flip.sold_price = 120;
+		flip.done = true;
+		db.add_flip(flip);
+	};
+
+	add_done_flip("Iron bar");
+	add_done_flip("Iron ore");
+	add_done_flip("iron bar");
+	db.add_flip(flips::flip("Iron bar", 100, 120, 1000));
+	add_done_flip("Steel bar");
+	add_done_flip("Bar of iron");
+	db.set_stat(db::stat_key::flips_done, 5);
+
+	SUBCASE("Exact names are case-insensitive and only include finished flips")
+	{
+		CHECK(db.find_flips_by_name("IRON BAR") == std::vector<u32>{ 0, 2 });
+		CHECK(db.find_flips_by_name("Steel bar") == std::vector<u32>{ 4 });
+		CHECK(db.find_flips_by_name("Mithril bar").empty());
+	}
+
+	SUBCASE("Prefix matches come before substring matches")
+	{
+		CHECK(db.search_items("iron") == std::vector<std::string>{ "Iron bar", "Iron ore", "Bar of iron" });
+		CHECK(db.search_items("bar") == std::vector<std::string>{ "Bar of iron", "Iron bar", "Steel bar" });
+		CHECK(db.search_items("xyz").empty());
+	}
+
+	SUBCASE("Renaming an item moves the flip in the index")
+	{
+		db.set_flip<db::flip_key::item>(1, "Steel bar");
+		CHECK(db.find_flips_by_name("Iron ore").empty());
+		CHECK(db.find_flips_by_name("Steel bar") == std::vector<u32>{ 1, 4 });
+	}
+}
+
 std::vector<u32> db::find_flips_by_count(const u32 flip_count) const
 {
 	std::vector<u32> result;
@@ -119,11 +611,11 @@ std::vector<u32> db::find_flips_by_count(const u32 flip_count) const
 	if (get_stat(stat_key::flips_done) == 0)
 		return result;
 
-	std::vector<stats::avg_stat> avg_stats = stats::flips_to_avg_stats(json_data["flips"]);
-	for (size_t i = 0; i < avg_stats.size(); i++)
+	for (u32 item_id = 0; item_id < store.item_stats.size(); ++item_id)
 	{
-		if (avg_stats[i].flip_count() <= flip_count)
-			result.emplace_back(i);
+		const stats::item_aggregate& aggregate = store.item_stats[item_id];
+		if (aggregate.flip_count > 0 && aggregate.flip_count <= flip_count)
+			result.emplace_back(aggregate.latest_trade_index);
 	}
 
 	return result;
@@ -131,22 +623,242 @@ std::vector<u32> db::find_flips_by_count(const u32 flip_count) const
 
 i64 db::get_stat(const stat_key key) const
 {
-	return json_data["stats"][stat_key_to_str.at(key)];
+	switch (key)
+	{
+		case stat_key::flips_done:	return store.flips_done;
+		case stat_key::profit:		return store.profit;
+	}
+
+	assert(false && "unknown stat key");
+	return 0;
 }
 
 void db::set_stat(const stat_key key, const i64 data)
 {
-	json_data["stats"][stat_key_to_str.at(key)] = data;
+	switch (key)
+	{
+		case stat_key::flips_done:
+			store.flips_done = data;
+			break;
+
+		case stat_key::profit:
+			store.profit = data;
+			break;
+	}
+
+	if (!operation_log)
+		return;
+
+	op_log::record record;
+	record.put(log_op::set_stat);
+	record.put(key);
+	record.put(data);
+	operation_log->stage(record);
 }
 
 void db::write()
 {
+	/* In-memory databases have nowhere to write to */
+	if (!operation_log)
+		return;
+
+	if (checkpoint_needed || operation_log->size() >= CHECKPOINT_LOG_SIZE)
+		checkpoint();
+	else
+		operation_log->commit();
+}
+
+void db::checkpoint()
+{
+	assert(operation_log);
 	assert(!file_paths::data_file.empty());
 
 	/* Backup the file before writing anything */
-	std::filesystem::copy_file(file_paths::data_file, file_paths::data_file + "_backup", std::filesystem::copy_options::overwrite_existing);
+	if (std::filesystem::exists(file_paths::data_file))
+		std::filesystem::copy_file(file_paths::data_file, file_paths::data_file + "_backup", std::filesystem::copy_options::overwrite_existing);
+
+	/* The new generation makes the current operation log stale even if
+	 * we crash before it has been emptied */
+	store.generation++;
 
-	flip_utils::write_json_file(json_data, file_paths::data_file);
+	if (!flip_utils::write_file_durable(file_paths::data_file, flip_store::serialize(store)))
+	{
+		std::cout << "Couldn't write the database to " << file_paths::data_file << '\n';
+		exit(1);
+	}
+
+	/* Everything staged is now part of the data file */
+	operation_log->discard();
+	operation_log->reset(store.generation);
+	checkpoint_needed = false;
+}
+
+void db::log_flip_change(const u32 index, const flip_key key, const i64 data)
+{
+	op_log::record record;
+	record.put(log_op::set_flip_num);
+	record.put(index);
+	record.put(key);
+	record.put(data);
+	operation_log->stage(record);
+}
+
+void db::log_flip_change(const u32 index, const flip_key key, const std::string& data)
+{
+	op_log::record record;
+	record.put(log_op::set_flip_str);
+	record.put(index);
+	record.put(key);
+	record.put(data);
+	operation_log->stage(record);
+}
+
+bool db::replay(const std::string& record)
+{
+	op_log::record_reader reader(record);
+
+	log_op op;
+	if (!reader.get(op))
+		return false;
+
+	switch (op)
+	{
+		case log_op::add_flip:
+		{
+			flips::flip flip;
+			u8 cancelled, done;
+
+			const bool ok = reader.get(flip.account)
+				&& reader.get(flip.item)
+				&& reader.get(flip.buy_price)
+				&& reader.get(flip.sell_price)
+				&& reader.get(flip.sold_price)
+				&& reader.get(flip.buylimit)
+				&& reader.get(cancelled)
+				&& reader.get(done);
+
+			if (!ok)
+				return false;
+
+			flip.cancelled = cancelled;
+			flip.done = done;
+			store_flip(flip);
+			break;
+		}
+
+		case log_op::set_flip_num:
+		case log_op::set_flip_str:
+		{
+			u32 index;
+			flip_key key;
+			if (!reader.get(index) || !reader.get(key) || index >= total_flip_count())
+				return false;
+
+			const bool string_key = key == flip_key::account || key == flip_key::item;
+			if (string_key != (op == log_op::set_flip_str) || key > flip_key::done)
+				return false;
+
+			if (string_key)
+			{
+				std::string data;
+				if (!reader.get(data))
+					return false;
+
+				store_flip_str(index, key, data);
+			}
+			else
+			{
+				i64 data;
+				if (!reader.get(data))
+					return false;
+
+				store_flip_num(index, key, data);
+			}
+			break;
+		}
+
+		case log_op::set_stat:
+		{
+			stat_key key;
+			i64 data;
+			if (!reader.get(key) || !reader.get(data) || key > stat_key::profit)
+				return false;
+
+			switch (key)
+			{
+				case stat_key::flips_done:	store.flips_done = data; break;
+				case stat_key::profit:		store.profit = data; break;
+			}
+			break;
+		}
+
+		case log_op::add_to_item_stats:
+		{
+			u32 index;
+			if (!reader.get(index) || index >= total_flip_count())
+				return false;
+
+			aggregate_flip(index);
+			break;
+		}
+
+		case log_op::rebuild_item_stats:
+			calculate_item_stats();
+			break;
+
+		default:
+			return false;
+	}
+
+	return reader.at_end();
+}
+
+nlohmann::json db::to_json() const
+{
+	nlohmann::json json_data;
+	json_data["stats"]["flips_done"] = store.flips_done;
+	json_data["stats"]["profit"] = store.profit;
+	json_data["flips"] = nlohmann::json::array();
+
+	for (u32 i = 0; i < total_flip_count(); ++i)
+		json_data["flips"].push_back(get_flip_obj(i).to_json());
+
+	return json_data;
+}
+
+TEST_CASE("Json conversion")
+{
+	constexpr char json_str[] = R"~~~({
+		"flips": [
+			{ "account": "alt1", "buy": 1101, "cancelled": false, "done": true, "item": "Tomato", "limit": 1376, "sell": 1271, "sold": 1207 },
+			{ "buy": 2254, "cancelled": false, "done": false, "item": "Iron bar", "limit": 9950, "sell": 2532, "sold": 0 },
+			{ "account": "alt1", "buy": 100, "cancelled": true, "done": false, "item": "Tomato", "limit": 1000, "sell": 200, "sold": 0 }
+		],
+		"stats": { "flips_done": 1, "profit": 91587 }
+	})~~~";
+
+	const nlohmann::json json_data = nlohmann::json::parse(json_str);
+	const db db(json_data);
+
+	CHECK(db.total_flip_count() == 3);
+	CHECK(db.get_stat(db::stat_key::flips_done) == 1);
+	CHECK(db.get_stat(db::stat_key::profit) == 91587);
+	CHECK(db.get_flip<std::string>(0, db::flip_key::item) == "Tomato");
+	CHECK(db.get_flip<std::string>(1, db::flip_key::account) == "main");
+	CHECK(db.get_flip<i32>(1, db::flip_key::limit) == 9950);
+	CHECK(db.get_flip<bool>(2, db::flip_key::cancelled));
+
+	/* Compile-time and runtime access agree */
+	CHECK(db.get_flip<db::flip_key::item>(2) == db.get_flip<std::string>(2, db::flip_key::item));
+	CHECK(db.get_flip<db::flip_key::sold>(0) == db.get_flip<i32>(0, db::flip_key::sold));
+	CHECK(db.get_flip<db::flip_key::cancelled>(2) == db.get_flip<bool>(2, db::flip_key::cancelled));
+	static_assert(std::is_same_v<db::flip_type<db::flip_key::done>, bool>);
+	static_assert(std::is_same_v<db::flip_type<db::flip_key::limit>, i32>);
+
+	/* The missing account gets filled in on export */
+	nlohmann::json expected = json_data;
+	expected["flips"][1]["account"] = "main";
+	CHECK(db.to_json() == expected);
 }
 
 bool db::validate(const nlohmann::json& json_obj)
@@ -161,7 +873,55 @@ bool db::validate(const nlohmann::json& json_obj)
 	return key_flips && key_stats && key_flips_done && key_profit;
 }
 
-void db::create_default_data_file()
+void db::load_json(const nlohmann::json& json_obj)
+{
+	store.clear();
+
+	if (json_obj.contains("flips"))
+	{
+		store.reserve(json_obj["flips"].size());
+		for (const nlohmann::json& flip : json_obj["flips"])
+			store_flip(flips::flip(flip));
+	}
+
+	rebuild_indices();
+
+	if (json_obj.contains("stats"))
+	{
+		store.flips_done = json_obj["stats"].value<i64>("flips_done", 0);
+		store.profit = json_obj["stats"].value<i64>("profit", 0);
+	}
+}
+
+void db::migrate_json_data_file()
 {
-	flip_utils::write_file(file_paths::data_file, DEFAULT_DATA_FILE);
+	std::cout << "Migrating " << file_paths::legacy_data_file << " to " << file_paths::data_file << '\n';
+
+	/* Read the json data file */
+	const std::string json_string = flip_utils::read_file(file_paths::legacy_data_file);
+	nlohmann::json json_data;
+
+	try
+	{
+		json_data = nlohmann::json::parse(json_string);
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "The database is possibly corrupted. Restore a backup to proceed.\nError: " << e.what() << '\n';
+		exit(1);
+	}
+
+	/* Validate the database before converting it to avoid writing
+	 * out a half empty database */
+	if (!validate(json_data))
+	{
+		std::cout << "The json database is missing information. Restore a backup to proceed\n";
+		exit(1);
+	}
+
+	load_json(json_data);
+	checkpoint();
+
+	/* The json file is left in place as a backup */
+	std::cout << "Migrated " << total_flip_count() << " flips. The old json file can be removed\n";
 }
@@ -91,7 +91,7 @@ namespace flips
 	void print_stats(const db& db, const i32 top_value_count)
 	{
 		/* Print top performing flips */
-		const std::vector<stats::avg_stat> stats = db.get_flip_avg_stats();
+		const stats::avg_stat_table stats = db.get_flip_stat_table();
 
 		if (stats.empty())
 		{
@@ -109,31 +109,57 @@ namespace flips
 			return;
 
 		flip_utils::print_title("Top flips by ROI-%");
-		const std::vector<stats::avg_stat> topROI = stats::sort_flips_by_roi(stats);
+		const size_t top_count = std::max(top_value_count, 0);
 
 		table flips_by_roi({"Item", "ROI-%", "Average profit"});
 
-		for (i32 i = 0; i < std::clamp(static_cast<int>(topROI.size()), 0, top_value_count); i++)
-			flips_by_roi.add_row({topROI[i].name, std::to_string(topROI[i].avg_roi()), flip_utils::round_big_numbers(topROI[i].avg_profit())});
+		for (const u32 i : stats::rank_flips_by_roi(stats, top_count))
+			flips_by_roi.add_row({stats[i].name(), std::to_string(stats[i].avg_roi()), flip_utils::round_big_numbers(stats[i].avg_profit())});
 
 		flips_by_roi.print();
 
 		std::cout << "\n";
 
 		flip_utils::print_title("Top flips by Profit");
-		const std::vector<stats::avg_stat> topProfit = stats::sort_flips_by_profit(stats);
 
 		table flips_by_profit({"Item", "Average profit", "ROI-%"});
 
-		for (i32 i = 0; i < std::clamp(static_cast<int>(topProfit.size()), 0, top_value_count); i++)
+		for (const u32 i : stats::rank_flips_by_profit(stats, top_count))
 		{
-			std::string avgprofit_string = flip_utils::round_big_numbers(topProfit[i].avg_profit());
-			flips_by_profit.add_row({topProfit[i].name, avgprofit_string, std::to_string(topProfit[i].avg_roi())});
+			std::string avgprofit_string = flip_utils::round_big_numbers(stats[i].avg_profit());
+			flips_by_profit.add_row({stats[i].name(), avgprofit_string, std::to_string(stats[i].avg_roi())});
 		}
 
 		flips_by_profit.print();
 	}
 
+	std::vector<std::string> repair(flip& flip)
+	{
+		std::vector<std::string> problems;
+
+		const auto check = [&flip, &problems](const bool has_problem, const char* problem)
+		{
+			if (!has_problem)
+				return;
+
+			problems.push_back(problem);
+			flip.done = false;
+			flip.cancelled = true;
+		};
+
+		check(flip.cancelled && flip.done, "is cancelled and done at the same time");
+		check(flip.buylimit == 0, "has a buy limit of zero");
+		check(flip.buy_price == 0, "has a buy price of zero");
+
+		/* The rest only matter for flips that are done. A flip that
+		 * was cancelled above isn't done anymore */
+		const bool done = flip.done;
+		check(done && flip.sell_price == 0, "has a sell price of zero");
+		check(done && flip.sold_price == 0, "has a sold price of zero");
+
+		return problems;
+	}
+
 	void fix_stats(db& db)
 	{
 		std::cout << "Recalculating statistics...\n";
@@ -148,7 +174,7 @@ namespace flips
 
 		const auto warning_prefix = [&db](const size_t flip_index) -> std::string
 		{
-			return std::format("Warning: flip {} [{}] ", flip_index, db.get_flip<std::string>(flip_index, db::flip_key::item));
+			return std::format("Warning: flip {} [{}] ", flip_index, db.get_flip<db::flip_key::item>(flip_index));
 		};
 
 		const auto action_postfix = [](const std::string& action) -> std::string
@@ -156,78 +182,43 @@ namespace flips
 			return std::format(" -> {}\n", action);
 		};
 
-		const auto cancel_flip = [&db, &action_postfix](const size_t flip_index)
-		{
-			std::cout << action_postfix("Marking the flip as cancelled");
-			db.set_flip<bool>(flip_index, db::flip_key::done, false);
-			db.set_flip<bool>(flip_index, db::flip_key::cancelled, true);
-		};
-
 		for (size_t i = 0; i < db.total_flip_count(); i++)
 		{
 			/* Warn about problematic flip data */
+			flip flip_data = db.get_flip_obj(i);
+			const std::vector<std::string> problems = repair(flip_data);
 
-			if (db.get_flip<bool>(i, db::flip_key::cancelled) && db.get_flip<bool>(i, db::flip_key::done))
-			{
-				std::cout << warning_prefix(i)
-					<< "is cancelled and done at the same time\n";
-				cancel_flip(i);
-			}
-
-			if (db.get_flip<u64>(i, db::flip_key::limit) == 0)
-			{
-				std::cout << warning_prefix(i)
-					<< "has a buy limit of zero\n";
-				cancel_flip(i);
-			}
-
-			if (db.get_flip<u64>(i, db::flip_key::buy) == 0)
-			{
-				std::cout << warning_prefix(i)
-					<< "has a buy price of zero\n";
-				cancel_flip(i);
-			}
-
-			/* Check if the flip is done */
-			if (db.get_flip<bool>(i, db::flip_key::done) == false)
-				continue;
-
-			/* Perform more checks */
-			if (db.get_flip<u64>(i, db::flip_key::sell) == 0)
-			{
-				std::cout << warning_prefix(i)
-					<< "has a sell price of zero\n";
-				cancel_flip(i);
-			}
+			for (const std::string& problem : problems)
+				std::cout << warning_prefix(i) << problem << '\n'
+					<< action_postfix("Marking the flip as cancelled");
 
-			if (db.get_flip<u64>(i, db::flip_key::sold) == 0)
+			if (!problems.empty())
 			{
-				std::cout << warning_prefix(i)
-					<< "has a sold price of zero\n";
-				cancel_flip(i);
+				db.set_flip<db::flip_key::done>(i, false);
+				db.set_flip<db::flip_key::cancelled>(i, true);
 			}
 
-
-			/* Skip cancelled flips */
-			if (db.get_flip<bool>(i, db::flip_key::cancelled) == true)
+			/* Skip flips that are cancelled or not done yet */
+			if (!flip_data.done || flip_data.cancelled)
 				continue;
 
 			flip_count++;
 
 			/* Flip is done, but the sold price is missing */
-			if (db.get_flip<u64>(i, db::flip_key::sold) == 0)
-				db.set_flip(i, db::flip_key::sold, db.get_flip<u64>(i, db::flip_key::sell));
+			if (db.get_flip<db::flip_key::sold>(i) == 0)
+				db.set_flip<db::flip_key::sold>(i, db.get_flip<db::flip_key::sell>(i));
 
 			/* Calculate the profit */
-			i32 buy_price 	= db.get_flip<u64>(i, db::flip_key::buy);
-			i32 sell_price 	= db.get_flip<u64>(i, db::flip_key::sold);
-			i32 limit 		= db.get_flip<u64>(i, db::flip_key::limit);
+			i32 buy_price 	= db.get_flip<db::flip_key::buy>(i);
+			i32 sell_price 	= db.get_flip<db::flip_key::sold>(i);
+			i32 limit 		= db.get_flip<db::flip_key::limit>(i);
 			total_profit += margin::calc_profit(buy_price, sell_price, limit);
 		}
 
 		/* Update the stats values */
 		db.set_stat(db::stat_key::profit, total_profit);
 		db.set_stat(db::stat_key::flips_done, flip_count);
+		db.rebuild_item_stats();
 
 		/* Print changes */
 		if (old_total_profit != total_profit)
@@ -243,20 +234,7 @@ namespace flips
 
 	void list(const db& db, const daily_progress& daily_progress, const std::string& account_filter)
 	{
-		std::vector<u32> undone_flips;
-
-		for (size_t i = 0; i < db.total_flip_count(); i++)
-		{
-			/* Check if the flip is done yet */
-			if (db.get_flip<bool>(i, db::flip_key::done))
-				continue;
-
-			/* Check if the flip has been cancelled */
-			if (db.get_flip<bool>(i, db::flip_key::cancelled))
-				continue;
-
-			undone_flips.push_back(i);
-		}
+		const std::vector<u32>& undone_flips = db.open_flip_indices();
 
 		if (undone_flips.empty())
 		{
@@ -272,7 +250,7 @@ namespace flips
 		{
 			/* If account other than main was used, print the account
 			 * column to the table */
-			if (db.get_flip<std::string>(undone_flips[i], db::flip_key::account) != "main")
+			if (db.get_flip<db::flip_key::account>(undone_flips[i]) != "main")
 				flips_only_with_main = false;
 		}
 
@@ -287,11 +265,11 @@ namespace flips
 		flip_utils::print_title("On-going flips");
 		for (size_t i = 0; i < undone_flips.size(); i++)
 		{
-			const std::string& flip_name	= db.get_flip<std::string>(undone_flips[i], db::flip_key::item);
-			const u32 flip_item_count		= db.get_flip<u32>(undone_flips[i], db::flip_key::limit);
-			const u64 flip_buy				= db.get_flip<u64>(undone_flips[i], db::flip_key::buy);
-			const u64 flip_sell				= db.get_flip<u64>(undone_flips[i], db::flip_key::sell);
-			const std::string& account		= db.get_flip<std::string>(undone_flips[i], db::flip_key::account);
+			const std::string& flip_name	= db.get_flip<db::flip_key::item>(undone_flips[i]);
+			const u32 flip_item_count		= db.get_flip<db::flip_key::limit>(undone_flips[i]);
+			const u64 flip_buy				= db.get_flip<db::flip_key::buy>(undone_flips[i]);
+			const u64 flip_sell				= db.get_flip<db::flip_key::sell>(undone_flips[i]);
+			const std::string& account		= db.get_flip<db::flip_key::account>(undone_flips[i]);
 
 			/* The minimum price and count for an item is 1 */
 			assert(!flip_name.empty());
@@ -326,39 +304,18 @@ namespace flips
 
 	i32 find_real_id_with_undone_id(const db& db, const u32 undone_id)
 	{
-		u32 undone_index = 0;
-		i32 result;
-		bool result_found = false;
-		for (size_t i = 0; i < db.total_flip_count(); i++)
-		{
-			/* Skip flips that are already done */
-			if (db.get_flip<bool>(i, db::flip_key::done) == true)
-				continue;
-
-			/* Skip cancelled flips */
-			if (db.get_flip<bool>(i, db::flip_key::cancelled) == true)
-				continue;
+		const std::vector<u32>& undone_flips = db.open_flip_indices();
 
-			if (undone_index != undone_id)
-				undone_index++;
-			else
-			{
-				result = i;
-				result_found = true;
-				break;
-			}
-		}
-
-		if (!result_found)
+		if (undone_id >= undone_flips.size())
 		{
 			std::cout << "No items matching ID [" << undone_id << "] were found!\n";
 			return -1;
 		}
 
-		return result;
+		return undone_flips[undone_id];
 	}
 
-	void cancel(db& db, const i32 ID)
+	bool cancel(db& db, const i32 ID)
 	{
 		/* Mark the flip as cancelled. It will be removed when the flip array
 		 * is loaded next time around and saved */
@@ -366,83 +323,88 @@ namespace flips
 
 		// flip_to_cancel will be -1 if the ID was bogus
 		if (flip_to_cancel < 0)
-			return;
+			return false;
 
-		assert(!db.get_flip<bool>(flip_to_cancel, db::flip_key::done));
+		assert(!db.get_flip<db::flip_key::done>(flip_to_cancel));
 
-		db.set_flip(flip_to_cancel, db::flip_key::cancelled, true);
+		db.set_flip<db::flip_key::cancelled>(flip_to_cancel, true);
+		db.add_to_item_stats(flip_to_cancel);
 
-		std::cout << "Flip [" << db.get_flip<std::string>(flip_to_cancel, db::flip_key::item) << "] cancelled!\n";
+		std::cout << "Flip [" << db.get_flip<db::flip_key::item>(flip_to_cancel) << "] cancelled!\n";
+		return true;
 	}
 
-	void update(db& db, const i32 ID, u32 buy_price, u32 sell_price, u32 buy_amount, std::string account_name)
+	bool update(db& db, const i32 ID, u32 buy_price, u32 sell_price, u32 buy_amount, std::string account_name)
 	{
 		/* Since the given ID is the ID from the flip list, we'll need to convert it into a flip index */
 		const i32 flip_index = find_real_id_with_undone_id(db, ID);
 
 		/* If no flips were found, bail out */
 		if (flip_index == -1)
-			return;
+			return false;
 
 		/* Update variables that have been changed by the user */
 
-		std::cout << "Updating item [" << db.get_flip<std::string>(flip_index, db::flip_key::item) << "]\n";
+		std::cout << "Updating item [" << db.get_flip<db::flip_key::item>(flip_index) << "]\n";
 
 		if (buy_price != 0)
 		{
-			std::cout << "Buy price: " << db.get_flip<u32>(flip_index, db::flip_key::buy) << " -> " << buy_price << '\n';
-			db.set_flip(flip_index, db::flip_key::buy, buy_price);
+			std::cout << "Buy price: " << db.get_flip<db::flip_key::buy>(flip_index) << " -> " << buy_price << '\n';
+			db.set_flip<db::flip_key::buy>(flip_index, buy_price);
 		}
 
 		if (sell_price != 0)
 		{
-			std::cout << "Sell price: " << db.get_flip<u32>(flip_index, db::flip_key::sell) << " -> " << sell_price << '\n';
-			db.set_flip(flip_index, db::flip_key::sell, sell_price);
+			std::cout << "Sell price: " << db.get_flip<db::flip_key::sell>(flip_index) << " -> " << sell_price << '\n';
+			db.set_flip<db::flip_key::sell>(flip_index, sell_price);
 		}
 
 		if (buy_amount != 0)
 		{
-			std::cout << "Item count: " << db.get_flip<u32>(flip_index, db::flip_key::limit) << " -> " << buy_amount << '\n';
-			db.set_flip(flip_index, db::flip_key::limit, buy_amount);
+			std::cout << "Item count: " << db.get_flip<db::flip_key::limit>(flip_index) << " -> " << buy_amount << '\n';
+			db.set_flip<db::flip_key::limit>(flip_index, buy_amount);
 		}
 
 		if (!account_name.empty())
 		{
-			std::cout << "Account: " << db.get_flip<std::string>(flip_index, db::flip_key::account) << " -> " << account_name << '\n';
-			db.set_flip(flip_index, db::flip_key::account, account_name);
+			std::cout << "Account: " << db.get_flip<db::flip_key::account>(flip_index) << " -> " << account_name << '\n';
+			db.set_flip<db::flip_key::account>(flip_index, account_name);
 		}
+
+		return true;
 	}
 
-	void sell(db& db, daily_progress& daily_progress, const i32 index, i32 sell_value, i32 sell_amount)
+	bool sell(db& db, daily_progress& daily_progress, const i32 index, i32 sell_value, i32 sell_amount)
 	{
 		const i32 flip_index = find_real_id_with_undone_id(db, index);
 		if (flip_index == -1)
-			return;
+			return false;
 
 		/* Update the flip values */
 		if (sell_amount == 0)
-			sell_amount = db.get_flip<u32>(flip_index, db::flip_key::limit);
+			sell_amount = db.get_flip<db::flip_key::limit>(flip_index);
 		else
-			db.set_flip(flip_index, db::flip_key::limit, sell_amount);
+			db.set_flip<db::flip_key::limit>(flip_index, sell_amount);
 
-		db.set_flip(flip_index, db::flip_key::done, true);
+		db.set_flip<db::flip_key::done>(flip_index, true);
 
 		if (sell_value == 0)
-			sell_value = db.get_flip<u64>(flip_index, db::flip_key::sell);
+			sell_value = db.get_flip<db::flip_key::sell>(flip_index);
 
-		db.set_flip(flip_index, db::flip_key::sold, sell_value);
+		db.set_flip<db::flip_key::sold>(flip_index, sell_value);
+		db.add_to_item_stats(flip_index);
 
 		/* Increment the total flip counter by one */
 		db.set_stat(db::stat_key::flips_done, db.get_stat(db::stat_key::flips_done) + 1);
 
-		const i32 profit = margin::calc_profit(db.get_flip<u32>(flip_index, db::flip_key::buy), sell_value, sell_amount);
+		const i32 profit = margin::calc_profit(db.get_flip<db::flip_key::buy>(flip_index), sell_value, sell_amount);
 
 		i64 total_profit = db.get_stat(db::stat_key::profit);
 		total_profit += profit;
 		db.set_stat(db::stat_key::profit, total_profit);
 
 		flip_utils::print_title("Flip complete");
-		std::cout << "Item: " << db.get_flip<std::string>(flip_index, db::flip_key::item) << '\n'
+		std::cout << "Item: " << db.get_flip<db::flip_key::item>(flip_index) << '\n'
 				<< "Profit: " << profit << " (" << flip_utils::round_big_numbers(profit) << ")\n"
 				<< "Total profit so far: " << total_profit << " (" << flip_utils::round_big_numbers(total_profit) << ")\n";
 
@@ -450,6 +412,7 @@ namespace flips
 		daily_progress.add_progress(profit);
 		std::cout << "\n";
 		daily_progress.print_progress();
+		return true;
 	}
 
 	void filter_name(const db& db, const std::string& name)
@@ -506,19 +469,19 @@ namespace flips
 		std::cout << "\n";
 
 		/** Calculate average buying and selling prices **/
-		std::cout << "\033[37mAverage buy price:  " << db.get_flip_average<u64>(found_flips, db::flip_key::buy) << "\033[0m\n";
-		std::cout << "\033[37mAverage sell price: " << db.get_flip_average<u64>(found_flips, db::flip_key::sold) << "\033[0m\n";
+		std::cout << "\033[37mAverage buy price:  " << db.get_flip_average<db::flip_key::buy>(found_flips) << "\033[0m\n";
+		std::cout << "\033[37mAverage sell price: " << db.get_flip_average<db::flip_key::sold>(found_flips) << "\033[0m\n";
 
 		std::cout << "\n";
 
 		/** Find min and max buy/sell prices **/
-		std::cout << "\033[34mMin buy price: " << db.get_flip_min<u64>(found_flips, db::flip_key::buy) << "\033[0m\n";
-		std::cout << "\033[34mMax buy price: " << db.get_flip_max<u64>(found_flips, db::flip_key::buy) << "\033[0m\n";
+		std::cout << "\033[34mMin buy price: " << db.get_flip_min<db::flip_key::buy>(found_flips) << "\033[0m\n";
+		std::cout << "\033[34mMax buy price: " << db.get_flip_max<db::flip_key::buy>(found_flips) << "\033[0m\n";
 
 		std::cout << "\n";
 
-		std::cout << "\033[35mMin sell price: " << db.get_flip_min<u64>(found_flips, db::flip_key::sold) << "\033[0m\n";
-		std::cout << "\033[35mMax sell price: " << db.get_flip_max<u64>(found_flips, db::flip_key::sold) << "\033[0m\n";
+		std::cout << "\033[35mMin sell price: " << db.get_flip_min<db::flip_key::sold>(found_flips) << "\033[0m\n";
+		std::cout << "\033[35mMax sell price: " << db.get_flip_max<db::flip_key::sold>(found_flips) << "\033[0m\n";
 	}
 
 	void filter_count(const db& db, const u32 flip_count)
@@ -533,7 +496,25 @@ namespace flips
 
 		std::vector<u32> flips = db.find_flips_by_count(flip_count);
 		for (const u32 flip : flips)
-			std::cout << db.get_flip<std::string>(flip, db::flip_key::item) << '\n';
+			std::cout << db.get_flip<db::flip_key::item>(flip) << '\n';
+	}
+
+	void filter_search(const db& db, const std::string& text)
+	{
+		const std::vector<std::string> items = db.search_items(text);
+
+		if (items.empty())
+		{
+			std::cout << "No items matching '" << text << "' were found\n";
+			return;
+		}
+
+		table search_results({"Item", "Flips done"});
+
+		for (const std::string& item : items)
+			search_results.add_row({ item, std::to_string(db.find_flips_by_name(item).size()) });
+
+		search_results.print();
 	}
 
 	bool flip_recommendations(const db& db, const tip_config& config)
@@ -547,14 +528,15 @@ namespace flips
 		if (db.total_flip_count() < 10)
 			return false;
 
-		// set the recommendation algorithm if the user wants to change it
-		if (config.recommendation_algorithm)
-			stats::avg_stat::set_recommendation_algorithm(config.recommendation_algorithm);
-
 		/* Read in the item recommendation blacklist */
 		const std::unordered_set<std::string> item_blacklist = flip_utils::read_file_items(file_paths::item_blacklist_file);
 
-		const std::vector<stats::avg_stat> recommended_flips = stats::sort_flips_by_recommendation(db.get_flip_avg_stats());
+		const stats::avg_stat_table item_stats = db.get_flip_stat_table();
+		stats::scoring_context scoring_context(item_stats);
+
+		// set the recommendation algorithm if the user wants to change it
+		if (config.recommendation_algorithm)
+			scoring_context.set_algorithm(config.recommendation_algorithm);
 
 		const std::vector<std::string> recommendation_table_column_names = { "Item name", "Average profit", "Count" };
 		table recommendation_table(recommendation_table_column_names);
@@ -563,38 +545,33 @@ namespace flips
 		static constexpr u32  rolling_avg_profit_window_size = 10;
 
 		/* How many items to recommend in total */
-		const size_t max = std::clamp(static_cast<u32>(recommended_flips.size()), 1U, config.max_result_count);
+		const size_t max = std::clamp(static_cast<u32>(item_stats.size()), 1U, config.max_result_count);
 
-		const auto should_flip_be_skipped = [&item_blacklist, &config](const stats::avg_stat& flip) -> bool
+		const auto should_flip_be_skipped = [&item_blacklist, &config](const stats::avg_stat_table::row& flip) -> bool
 		{
 			const bool is_below_threshold = flip.rolling_avg_profit(rolling_avg_profit_window_size) < config.profit_threshold;
-			const bool is_blacklisted = item_blacklist.contains(flip.name) && config.use_blacklist;
+			const bool is_blacklisted = item_blacklist.contains(flip.name()) && config.use_blacklist;
 			const bool not_enough_data = flip.flip_count() < 2;
 			return is_below_threshold || is_blacklisted || not_enough_data;
 		};
 
+		/* Only rank as many items as it takes to find enough recommendations */
+		const stats::top_flips recommended_flips = stats::select_top_flips_by_recommendation(item_stats, scoring_context, max, [&should_flip_be_skipped](const stats::avg_stat_table::row& flip) {
+			return !should_flip_be_skipped(flip);
+		});
+
 		// If we are printing in ge-inspector format, build the string
 		// only and don't build the recommendation table
 		if (config.ge_inspector_format)
 		{
-			u32 count{};
 			std::string ge_inspector_format_str;
 
-			for (const stats::avg_stat& flip : recommended_flips)
-			{
-				// Check if we have reached the requested amount of recommendations
-				if (count >= max)
-					break;
-
-				if (should_flip_be_skipped(flip))
-					continue;
-
-				ge_inspector_format_str += flip.name + ';';
-				++count;
-			}
+			for (const u32 index : recommended_flips.accepted)
+				ge_inspector_format_str += item_stats[index].name() + ';';
 
 			// Remove the last semicolon
-			ge_inspector_format_str.erase(ge_inspector_format_str.end() - 1);
+			if (!ge_inspector_format_str.empty())
+				ge_inspector_format_str.erase(ge_inspector_format_str.end() - 1);
 
 			std::cout << ge_inspector_format_str << '\n';
 
@@ -602,15 +579,12 @@ namespace flips
 		}
 
 		// Build the recommendation table
-		for (size_t i = 0; i < recommended_flips.size() && recommendation_table.row_count() < max; ++i)
+		for (const u32 index : recommended_flips.accepted)
 		{
-			if (should_flip_be_skipped(recommended_flips[i]))
-				continue;
-
 			recommendation_table.add_row({
-				recommended_flips[i].name,
-				flip_utils::round_big_numbers(recommended_flips[i].rolling_avg_profit(rolling_avg_profit_window_size)),
-				std::to_string(recommended_flips[i].flip_count())
+				item_stats[index].name(),
+				flip_utils::round_big_numbers(item_stats[index].rolling_avg_profit(rolling_avg_profit_window_size)),
+				std::to_string(item_stats[index].flip_count())
 			});
 		}
 
@@ -625,9 +599,9 @@ namespace flips
 		recommendation_table.print();
 
 		// Pick some random flips
-		const size_t max_random_count = config.max_random_flip_count < recommended_flips.size() - recommendation_table.row_count()
+		const size_t max_random_count = config.max_random_flip_count < item_stats.size() - recommendation_table.row_count()
 			? config.max_random_flip_count
-			: recommended_flips.size() - recommendation_table.row_count();
+			: item_stats.size() - recommendation_table.row_count();
 
 		// If there are no random flips to print, return early
 		if (max_random_count == 0 || max > recommendation_table.row_count())
@@ -640,13 +614,24 @@ namespace flips
 
 		table random_table(recommendation_table_column_names);
 
+		// the random flips are picked from the items that didn't rank in the top
+		std::vector<bool> is_top_flip(item_stats.size(), false);
+		for (size_t i = 0; i < max; ++i)
+			is_top_flip[recommended_flips.ranked[i]] = true;
+
+		std::vector<u32> other_flips;
+		other_flips.reserve(item_stats.size() - max);
+		for (u32 i = 0; i < item_stats.size(); ++i)
+			if (!is_top_flip[i])
+				other_flips.push_back(i);
+
 		for (u32 j = 0; j < max_random_count; ++j)
 		{
-			const u32 index = rng.range(max, recommended_flips.size() - 1);
+			const u32 index = other_flips[rng.range<size_t>(0, other_flips.size() - 1)];
 			random_table.add_row({
-				recommended_flips[index].name,
-				flip_utils::round_big_numbers(recommended_flips[index].rolling_avg_profit(rolling_avg_profit_window_size)),
-				std::to_string(recommended_flips[index].flip_count())
+				item_stats[index].name(),
+				flip_utils::round_big_numbers(item_stats[index].rolling_avg_profit(rolling_avg_profit_window_size)),
+				std::to_string(item_stats[index].flip_count())
 			});
 		}
 
@@ -0,0 +1,418 @@
+#include "FlipStore.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <doctest/doctest.h>
+
+static_assert(std::endian::native == std::endian::little, "the flip store format is little-endian only");
+
+namespace flip_store
+{
+	struct header
+	{
+		char magic[8];
+		u32 version;
+		u32 flip_count;
+		u32 item_count;
+		u32 account_count;
+		i64 profit;
+		i64 flips_done;
+		u64 generation;
+		u64 checksum; /* FNV-1a of everything after the header */
+	};
+
+	static_assert(sizeof(header) == 56);
+
+	static u64 checksum(const char* data, const size_t size)
+	{
+		u64 hash = 0xcbf29ce484222325;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= static_cast<u8>(data[i]);
+			hash *= 0x100000001b3;
+		}
+		return hash;
+	}
+
+	u32 dictionary::intern(const std::string& str)
+	{
+		const auto [it, inserted] = ids.try_emplace(str, values.size());
+		if (inserted)
+			values.push_back(str);
+
+		return it->second;
+	}
+
+	const std::string& dictionary::at(const u32 id) const
+	{
+		assert(id < values.size());
+		return values[id];
+	}
+
+	size_t dictionary::size() const
+	{
+		return values.size();
+	}
+
+	const std::vector<std::string>& dictionary::strings() const
+	{
+		return values;
+	}
+
+	void dictionary::clear()
+	{
+		values.clear();
+		ids.clear();
+	}
+
+	size_t columns::size() const
+	{
+		return item.size();
+	}
+
+	void columns::reserve(const size_t flip_count)
+	{
+		account.reserve(flip_count);
+		item.reserve(flip_count);
+		buy.reserve(flip_count);
+		sell.reserve(flip_count);
+		sold.reserve(flip_count);
+		limit.reserve(flip_count);
+		cancelled.reserve(flip_count);
+		done.reserve(flip_count);
+	}
+
+	void columns::clear()
+	{
+		accounts.clear();
+		items.clear();
+		account.clear();
+		item.clear();
+		buy.clear();
+		sell.clear();
+		sold.clear();
+		limit.clear();
+		cancelled.clear();
+		done.clear();
+		item_stats.clear();
+		flips_done = 0;
+		profit = 0;
+		generation = 0;
+	}
+
+	template<typename T>
+	static void append(std::string& out, const T& value)
+	{
+		out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template<typename T>
+	static void append_column(std::string& out, const std::vector<T>& column)
+	{
+		out.append(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+	}
+
+	static void append_dictionary(std::string& out, const dictionary& dict)
+	{
+		for (const std::string& str : dict.strings())
+		{
+			append<u32>(out, str.size());
+			out.append(str);
+		}
+	}
+
+	std::string serialize(const columns& data)
+	{
+		const size_t flip_count = data.size();
+		assert(data.account.size() == flip_count);
+		assert(data.buy.size() == flip_count);
+		assert(data.sell.size() == flip_count);
+		assert(data.sold.size() == flip_count);
+		assert(data.limit.size() == flip_count);
+		assert(data.cancelled.size() == flip_count);
+		assert(data.done.size() == flip_count);
+		assert(data.item_stats.size() <= data.items.size());
+
+		std::string out;
+		out.reserve(sizeof(header) + flip_count * (sizeof(u32) * 2 + sizeof(i32) * 4 + 2));
+		out.resize(sizeof(header));
+
+		append_dictionary(out, data.items);
+		append_dictionary(out, data.accounts);
+
+		append_column(out, data.account);
+		append_column(out, data.item);
+		append_column(out, data.buy);
+		append_column(out, data.sell);
+		append_column(out, data.sold);
+		append_column(out, data.limit);
+		append_column(out, data.cancelled);
+		append_column(out, data.done);
+
+		append_column(out, data.item_stats);
+		out.append((data.items.size() - data.item_stats.size()) * sizeof(stats::item_aggregate), '\0');
+
+		header head;
+		std::memcpy(head.magic, magic, sizeof(magic));
+		head.version		= format_version;
+		head.flip_count		= flip_count;
+		head.item_count		= data.items.size();
+		head.account_count	= data.accounts.size();
+		head.profit			= data.profit;
+		head.flips_done		= data.flips_done;
+		head.generation		= data.generation;
+		head.checksum		= checksum(out.data() + sizeof(header), out.size() - sizeof(header));
+
+		std::memcpy(out.data(), &head, sizeof(header));
+
+		return out;
+	}
+
+	/* Bounds checked reader for the serialized data */
+	class reader
+	{
+	public:
+		reader(const std::string& bytes, const size_t offset)
+		:bytes(bytes), offset(offset)
+		{}
+
+		template<typename T>
+		bool read(T& value)
+		{
+			if (bytes.size() - offset < sizeof(T))
+				return false;
+
+			std::memcpy(&value, bytes.data() + offset, sizeof(T));
+			offset += sizeof(T);
+			return true;
+		}
+
+		template<typename T>
+		bool read_column(std::vector<T>& column, const size_t count)
+		{
+			if ((bytes.size() - offset) / sizeof(T) < count)
+				return false;
+
+			column.resize(count);
+			std::memcpy(column.data(), bytes.data() + offset, count * sizeof(T));
+			offset += count * sizeof(T);
+			return true;
+		}
+
+		bool skip(const size_t size)
+		{
+			if (bytes.size() - offset < size)
+				return false;
+
+			offset += size;
+			return true;
+		}
+
+		bool read_dictionary(dictionary& dict, const size_t count)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				u32 length;
+				if (!read(length) || bytes.size() - offset < length)
+					return false;
+
+				dict.intern(bytes.substr(offset, length));
+				offset += length;
+			}
+
+			/* Duplicate strings would shift the ids of the following strings */
+			return dict.size() == count;
+		}
+
+		bool at_end() const
+		{
+			return offset == bytes.size();
+		}
+
+	private:
+		const std::string& bytes;
+		size_t offset;
+	};
+
+	template<typename T>
+	static bool ids_in_range(const std::vector<T>& ids, const size_t dictionary_size)
+	{
+		return std::all_of(ids.begin(), ids.end(), [dictionary_size](const T id) { return id < dictionary_size; });
+	}
+
+	/* Size of a single item aggregate in version 3 and 4 files */
+	constexpr size_t v3_item_aggregate_size = 176;
+	constexpr size_t v4_item_aggregate_size = 200;
+
+	bool deserialize(const std::string& bytes, columns& data)
+	{
+		data.clear();
+
+		header head;
+		if (bytes.size() < sizeof(header))
+			return false;
+
+		std::memcpy(&head, bytes.data(), sizeof(header));
+
+		if (std::memcmp(head.magic, magic, sizeof(magic)) != 0 || head.version < oldest_supported_version || head.version > format_version)
+			return false;
+
+		if (head.checksum != checksum(bytes.data() + sizeof(header), bytes.size() - sizeof(header)))
+			return false;
+
+		reader in(bytes, sizeof(header));
+
+		const bool ok = in.read_dictionary(data.items, head.item_count)
+			&& in.read_dictionary(data.accounts, head.account_count)
+			&& in.read_column(data.account, head.flip_count)
+			&& in.read_column(data.item, head.flip_count)
+			&& in.read_column(data.buy, head.flip_count)
+			&& in.read_column(data.sell, head.flip_count)
+			&& in.read_column(data.sold, head.flip_count)
+			&& in.read_column(data.limit, head.flip_count)
+			&& in.read_column(data.cancelled, head.flip_count)
+			&& in.read_column(data.done, head.flip_count)
+			&& (head.version != 3 || in.skip(head.item_count * v3_item_aggregate_size))
+			&& (head.version != 4 || in.skip(head.item_count * v4_item_aggregate_size))
+			&& (head.version < 5 || in.read_column(data.item_stats, head.item_count))
+			&& in.at_end()
+			&& ids_in_range(data.item, data.items.size())
+			&& ids_in_range(data.account, data.accounts.size());
+
+		if (!ok)
+		{
+			data.clear();
+			return false;
+		}
+
+		data.profit = head.profit;
+		data.flips_done = head.flips_done;
+		data.generation = head.generation;
+
+		return true;
+	}
+
+	TEST_CASE("Flip store serialization round trip")
+	{
+		columns data;
+		const u32 main_account = data.accounts.intern("main");
+		const u32 alt_account = data.accounts.intern("alt1");
+		CHECK(data.accounts.intern("main") == main_account);
+
+		const auto add = [&](const std::string& item, const u32 account, const i32 buy, const i32 sell, const i32 sold, const i32 limit, const bool cancelled, const bool done)
+		{
+			data.item.push_back(data.items.intern(item));
+			data.account.push_back(account);
+			data.buy.push_back(buy);
+			data.sell.push_back(sell);
+			data.sold.push_back(sold);
+			data.limit.push_back(limit);
+			data.cancelled.push_back(cancelled);
+			data.done.push_back(done);
+		};
+
+		add("Iron bar", main_account, 2254, 2532, 2480, 9950, false, true);
+		add("Tomato", alt_account, 1101, 1271, 0, 1376, false, false);
+		add("Iron bar", alt_account, 2261, 2540, 0, 5000, true, false);
+		data.item_stats.resize(1);
+		data.item_stats[0].add_flip(-12'345, 2.5, 9950, 0);
+		data.item_stats[0].add_cancel();
+		data.profit = 2'131'337;
+		data.flips_done = 1;
+		data.generation = 7;
+
+		const std::string bytes = serialize(data);
+
+		columns loaded;
+		REQUIRE(deserialize(bytes, loaded));
+
+		CHECK(loaded.size() == 3);
+		CHECK(loaded.items.size() == 2);
+		CHECK(loaded.accounts.size() == 2);
+		CHECK(loaded.items.at(loaded.item[2]) == "Iron bar");
+		CHECK(loaded.accounts.at(loaded.account[1]) == "alt1");
+		CHECK(loaded.buy == data.buy);
+		CHECK(loaded.sell == data.sell);
+		CHECK(loaded.sold == data.sold);
+		CHECK(loaded.limit == data.limit);
+		CHECK(loaded.cancelled == data.cancelled);
+		CHECK(loaded.done == data.done);
+		REQUIRE(loaded.item_stats.size() == 2);
+		CHECK(loaded.item_stats[0].total_profit == -12'345);
+		CHECK(loaded.item_stats[0].cancelled_flip_count == 1);
+		CHECK(loaded.item_stats[0].recent_profits[0] == -12'345);
+		CHECK(loaded.item_stats[1].flip_count == 0);
+		CHECK(loaded.profit == data.profit);
+		CHECK(loaded.flips_done == data.flips_done);
+		CHECK(loaded.generation == data.generation);
+
+		SUBCASE("Corrupted data is rejected")
+		{
+			std::string corrupted = bytes;
+			corrupted[corrupted.size() - 3] ^= 0x1;
+			CHECK_FALSE(deserialize(corrupted, loaded));
+			CHECK(loaded.size() == 0);
+		}
+
+		SUBCASE("Truncated data is rejected")
+		{
+			CHECK_FALSE(deserialize(bytes.substr(0, bytes.size() - 1), loaded));
+			CHECK_FALSE(deserialize(bytes.substr(0, 20), loaded));
+		}
+
+		SUBCASE("Version 2 data is loaded without the item aggregates")
+		{
+			std::string old_bytes = bytes.substr(0, bytes.size() - data.items.size() * sizeof(stats::item_aggregate));
+
+			header head;
+			std::memcpy(&head, old_bytes.data(), sizeof(header));
+			head.version = 2;
+			head.checksum = checksum(old_bytes.data() + sizeof(header), old_bytes.size() - sizeof(header));
+			std::memcpy(old_bytes.data(), &head, sizeof(header));
+
+			REQUIRE(deserialize(old_bytes, loaded));
+			CHECK(loaded.size() == 3);
+			CHECK(loaded.item_stats.empty());
+		}
+
+		SUBCASE("Version 3 data is loaded without the item aggregates")
+		{
+			std::string old_bytes = bytes.substr(0, bytes.size() - data.items.size() * sizeof(stats::item_aggregate));
+			old_bytes.append(data.items.size() * v3_item_aggregate_size, '\0');
+
+			header head;
+			std::memcpy(&head, old_bytes.data(), sizeof(header));
+			head.version = 3;
+			head.checksum = checksum(old_bytes.data() + sizeof(header), old_bytes.size() - sizeof(header));
+			std::memcpy(old_bytes.data(), &head, sizeof(header));
+
+			REQUIRE(deserialize(old_bytes, loaded));
+			CHECK(loaded.size() == 3);
+			CHECK(loaded.item_stats.empty());
+		}
+
+		SUBCASE("Version 4 data is loaded without the item aggregates")
+		{
+			std::string old_bytes = bytes.substr(0, bytes.size() - data.items.size() * sizeof(stats::item_aggregate));
+			old_bytes.append(data.items.size() * v4_item_aggregate_size, '\0');
+
+			header head;
+			std::memcpy(&head, old_bytes.data(), sizeof(header));
+			head.version = 4;
+			head.checksum = checksum(old_bytes.data() + sizeof(header), old_bytes.size() - sizeof(header));
+			std::memcpy(old_bytes.data(), &head, sizeof(header));
+
+			REQUIRE(deserialize(old_bytes, loaded));
+			CHECK(loaded.size() == 3);
+			CHECK(loaded.item_stats.empty());
+		}
+
+		SUBCASE("Empty store")
+		{
+			CHECK(deserialize(serialize(columns()), loaded));
+			CHECK(loaded.size() == 0);
+		}
+	}
+}
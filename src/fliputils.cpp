@@ -1,9 +1,14 @@
 #include "FlipUtils.hpp"
 
+#include <cctype>
+#include <cerrno>
 #include <doctest/doctest.h>
+#include <fcntl.h>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <nlohmann/json.hpp>
+#include <unistd.h>
 
 namespace flip_utils
 {
@@ -137,6 +142,53 @@ namespace flip_utils
 		file << std::setw(4) << json_data << std::endl;
 	}
 
+	bool write_fd(const int fd, const std::string& data)
+	{
+		size_t written = 0;
+		while (written < data.size())
+		{
+			const ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+			if (result < 0 && errno == EINTR)
+				continue;
+
+			if (result <= 0)
+				return false;
+
+			written += result;
+		}
+
+		return true;
+	}
+
+	bool write_file_durable(const std::string& filepath, const std::string& data)
+	{
+		const std::string temp_path = filepath + ".tmp";
+
+		const int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return false;
+
+		const bool written = write_fd(fd, data) && fsync(fd) == 0;
+		close(fd);
+
+		if (!written || std::rename(temp_path.c_str(), filepath.c_str()) != 0)
+		{
+			std::filesystem::remove(temp_path);
+			return false;
+		}
+
+		/* Make sure that the rename itself survives a crash */
+		const std::string directory = std::filesystem::path(filepath).parent_path().string();
+		const int dir_fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd >= 0)
+		{
+			fsync(dir_fd);
+			close(dir_fd);
+		}
+
+		return true;
+	}
+
 	std::string str_to_lower(const std::string& str)
 	{
 		std::string lowercase_str;
@@ -149,6 +201,57 @@ namespace flip_utils
 		return lowercase_str;
 	}
 
+	std::vector<std::string> split_command_line(const std::string& line)
+	{
+		std::vector<std::string> args;
+		std::string arg;
+		bool in_arg = false;
+		bool in_quotes = false;
+
+		for (const char c : line)
+		{
+			if (c == '"')
+			{
+				in_quotes = !in_quotes;
+				in_arg = true;
+			}
+			else if (in_quotes || !std::isspace(static_cast<unsigned char>(c)))
+			{
+				if (c == '#' && !in_quotes && !in_arg)
+					break;
+
+				arg += c;
+				in_arg = true;
+			}
+			else if (in_arg)
+			{
+				args.push_back(arg);
+				arg.clear();
+				in_arg = false;
+			}
+		}
+
+		if (in_arg)
+			args.push_back(arg);
+
+		return args;
+	}
+
+	TEST_CASE("Split command lines")
+	{
+		using args = std::vector<std::string>;
+
+		CHECK(split_command_line("") == args{});
+		CHECK(split_command_line("   \t") == args{});
+		CHECK(split_command_line("sold -i 3") == args{ "sold", "-i", "3" });
+		CHECK(split_command_line("  list\tmain \n") == args{ "list", "main" });
+		CHECK(split_command_line("add -i \"Iron bar\" -b 100") == args{ "add", "-i", "Iron bar", "-b", "100" });
+		CHECK(split_command_line("list \"\"") == args{ "list", "" });
+		CHECK(split_command_line("# a comment") == args{});
+		CHECK(split_command_line("cancel -i 2 # wrong item") == args{ "cancel", "-i", "2" });
+		CHECK(split_command_line("add -i \"Rune #1\"") == args{ "add", "-i", "Rune #1" });
+	}
+
 	f64 limes(const f64 approach_value, const f64 diminishing_returns, const f64 slope, const f64 value)
 	{
 		return value < 0.001 ? -300 : approach_value - diminishing_returns / value * slope;
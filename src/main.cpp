@@ -1,19 +1,27 @@
 #define DOCTEST_CONFIG_IMPLEMENT
 
+#include "Benchmark.hpp"
 #include "DB.hpp"
 #include "Dailygoal.hpp"
+#include "FilePaths.hpp"
 #include "FlipUtils.hpp"
 #include "Flips.hpp"
 #include "Margin.hpp"
 #include "Optimize_v2.hpp"
+#include "Recommendations.hpp"
+#include "Server.hpp"
+#include "Transfer.hpp"
 #include "Types.hpp"
 
 #include <clipp.h>
 #include <doctest/doctest.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
 
 enum class mode
 {
-	tips, optimize, calc, add, sold, cancel, update, list, filtering, stats, progress, repair, help, test
+	tips, optimize, calc, add, sold, cancel, update, list, filtering, stats, progress, repair, import_db, export_db, batch, serve, bench, help, test
 };
 
 struct options
@@ -24,19 +32,24 @@ struct options
 
 	u16 id{};
 	std::string item_name;
+	std::string search_text;
 	std::string account;
 
 	u32 flip_count{};
 	u32 result_count = 10;
 
+	std::string file_path;
+	bool transactional = false;
+	bool csv_format = false;
+	bool jsonl_format = false;
+
 	flips::tip_config tips;
+	optimize_config optimize;
 };
 
-int main(int argc, char** argv)
+/* The command line interface. Parsing sets the selected mode and the options */
+static auto make_cli(mode& selected_mode, options& options)
 {
-	mode selected_mode = mode::tips;
-	options options;
-
 	const auto tips = (
 		clipp::command("tips").set(selected_mode, mode::tips) % "mode",
 		(clipp::option("-t") & clipp::number("profit", options.tips.profit_threshold)) % "profit threshold",
@@ -48,7 +61,13 @@ int main(int argc, char** argv)
 	) % "recommend flips based on past flipping data";
 
 	const auto optimize = (
-		clipp::command("optimize").set(selected_mode, mode::optimize) % "mode"
+		clipp::command("optimize").set(selected_mode, mode::optimize) % "mode",
+		(clipp::option("-j", "--threads") & clipp::number("count", options.optimize.thread_count)) % "evaluate weights with multiple threads (0 = all cores, def: 1)",
+		(clipp::option("--crn") & clipp::number("scenarios", options.optimize.scenario_count)) % "compare weights on a fixed set of simulated scenarios (common random numbers, e.g. 64)",
+		(clipp::option("--seed").set(options.optimize.fixed_seed) & clipp::number("seed", options.optimize.seed)) % "seed for the random numbers to make the run repeatable",
+		(clipp::option("--max-iterations") & clipp::number("count", options.optimize.max_iterations)) % "stop after evaluating this many weight candidates",
+		(clipp::option("--time-budget") & clipp::number("seconds", options.optimize.time_budget)) % "stop after this many seconds",
+		clipp::option("--resume").set(options.optimize.resume) % "continue the previous run from its checkpoint"
 	) % "optimize the v2 recommendation algorithm weights based on past data with repeated simulations";
 
 	const auto calc = (
@@ -97,7 +116,8 @@ int main(int argc, char** argv)
 		clipp::command("filter").set(selected_mode, mode::filtering) % "mode",
 		clipp::one_of(
 			(clipp::option("-i") & clipp::value("name").set(options.item_name)) % "find stats for a specific item",
-			(clipp::option("-c") & clipp::number("count").set(options.flip_count)) % "find flips that have been done count <= times"
+			(clipp::option("-c") & clipp::number("count").set(options.flip_count)) % "find flips that have been done count <= times",
+			(clipp::option("-s") & clipp::value("text").set(options.search_text)) % "search for items with names that start with or contain the text"
 		)
 	) % "look for items with filters";
 
@@ -114,6 +134,32 @@ int main(int argc, char** argv)
 		clipp::command("repair").set(selected_mode, mode::repair) % "attempts to repair the statistics from the flip data in-case of some bug"
 	);
 
+	const auto import_db = (
+		clipp::command("import").set(selected_mode, mode::import_db) % "mode",
+		(clipp::option("--csv").set(options.csv_format) | clipp::option("--jsonl").set(options.jsonl_format)) % "format of the file, picked from the file extension by default",
+		clipp::value("file").set(options.file_path) % "CSV or JSON lines file with one flip per line, - reads them from stdin"
+	) % "add flips from a CSV or JSON lines file";
+
+	const auto export_db = (
+		clipp::command("export").set(selected_mode, mode::export_db) % "mode",
+		(clipp::option("--csv").set(options.csv_format) | clipp::option("--jsonl").set(options.jsonl_format)) % "export the flips as CSV or JSON lines instead",
+		clipp::value("file").set(options.file_path).required(false) % "write to a file instead of stdout"
+	) % "export the database in the old json format";
+
+	const auto batch = (
+		clipp::command("batch").set(selected_mode, mode::batch) % "mode",
+		clipp::option("-t").set(options.transactional) % "write nothing if any of the commands fail",
+		clipp::value("file").set(options.file_path) % "file with one command per line, - reads them from stdin"
+	) % "run many commands and write the database only once at the end";
+
+	const auto serve = (
+		clipp::command("serve").set(selected_mode, mode::serve) % "keep the database loaded and run the commands of other flip processes until stopped with Ctrl-C"
+	);
+
+	const auto bench = (
+		clipp::command("bench").set(selected_mode, mode::bench) % "measure the performance of the recommendation code with generated data"
+	);
+
 	const auto help = (
 		clipp::command("help").set(selected_mode, mode::help) % "show help"
 	);
@@ -122,34 +168,238 @@ int main(int argc, char** argv)
 		clipp::command("test").set(selected_mode, mode::test) % "run unit tests"
 	);
 
-	const auto cli = (
-		( tips | optimize | calc | add | sold | cancel | update | list | filtering | stats | progress | repair | help | test )
+	return (
+		( tips | optimize | calc | add | sold | cancel | update | list | filtering | stats | progress | repair | import_db | export_db | batch | serve | bench | help | test )
 	);
+}
 
-#ifndef FUZZING
-	if (!clipp::parse(argc, argv, cli))
+/* The format picked with --csv or --jsonl */
+static std::optional<transfer::format> selected_transfer_format(const options& options)
+{
+	if (options.csv_format)
+		return transfer::format::csv;
+
+	if (options.jsonl_format)
+		return transfer::format::jsonl;
+
+	return std::nullopt;
+}
+
+/* Commands that only need the database can be run by the server and in batches */
+static bool can_forward(const mode selected_mode, const options& options)
+{
+	switch (selected_mode)
+	{
+		case mode::tips:
+		case mode::calc:
+		case mode::add:
+		case mode::sold:
+		case mode::cancel:
+		case mode::update:
+		case mode::list:
+		case mode::filtering:
+		case mode::stats:
+		case mode::progress:
+		case mode::repair:
+			return true;
+
+		// the server would resolve a relative path from its own working directory
+		// and it would have to hold all of the CSV or JSON lines in memory
+		case mode::export_db:
+			return options.file_path.empty() && !options.csv_format && !options.jsonl_format;
+
+		default:
+			return false;
+	}
+}
+
+/* Changes are written to the database only if write_changes is set */
+template<typename cli_type>
+static i32 run_command(const mode selected_mode, const options& options, const cli_type& cli, db& db, daily_progress& daily_progress, const bool write_changes);
+
+/* Run a command line sent to the server */
+static i32 run_forwarded_command(const std::vector<std::string>& args, db& db)
+{
+	mode selected_mode = mode::tips;
+	options options;
+	const auto cli = make_cli(selected_mode, options);
+
+	if (!clipp::parse(args.begin(), args.end(), cli))
 	{
 		std::cout << "Invalid arguments were provided. Please check 'flip help'\n";
 		return 1;
 	}
-#else
-	std::cout << "Fuzzing instrumentation is enabled. CLI args are read from stdin\n";
-	std::vector<std::string> cli_args;
+
+	if (!can_forward(selected_mode, options))
 	{
-		std::string word;
-		while (std::getline(std::cin, word, ' '))
+		std::cout << "This command can't be run by the server\n";
+		return 1;
+	}
+
+	// the optimizer might've found new weights since the previous command
+	load_v2_recommendation_weights(file_paths::v2_weights_file);
+
+	// the day might've changed or the goal might've been edited since the previous command
+	daily_progress daily_progress;
+
+	return run_command(selected_mode, options, cli, db, daily_progress, true);
+}
+
+/* Run the commands in the file one per line and write the changes once at the end.
+ * In transactional mode the first failing command stops the batch and nothing is written */
+static i32 run_batch(const std::string& file_path, const bool transactional, db& db, daily_progress& daily_progress)
+{
+	// the server has its own copy of the database, which would get out of sync
+	if (server::is_running(file_paths::server_socket_file))
+	{
+		std::cout << "flip serve is running. Stop it before running a batch\n";
+		return 1;
+	}
+
+	std::ifstream file;
+	if (file_path != "-")
+	{
+		file.open(file_path);
+		if (!file.is_open())
 		{
-			if (!word.empty())
-			{
-				// strip out newline characters from the end of the line
-				if (word.at(word.size() - 1) == '\n')
-					word.erase(word.size() - 1, 1);
+			std::cout << "Can't open " << file_path << '\n';
+			return 1;
+		}
+	}
+
+	std::istream& input = file_path == "-" ? std::cin : file;
+
+	u32 line_number{0};
+	u32 command_count{0};
+	u32 failed_count{0};
+	std::string line;
+
+	while (std::getline(input, line))
+	{
+		line_number++;
+
+		const std::vector<std::string> args = flip_utils::split_command_line(line);
+		if (args.empty())
+			continue;
+
+		command_count++;
 
-				cli_args.push_back(word);
+		mode selected_mode = mode::tips;
+		options options;
+		const auto cli = make_cli(selected_mode, options);
+
+		i32 exit_code = 1;
+		if (!clipp::parse(args.begin(), args.end(), cli))
+		{
+			std::cout << "Invalid arguments\n";
+		}
+		else if (!can_forward(selected_mode, options))
+		{
+			std::cout << "This command can't be run in a batch\n";
+		}
+		else
+		{
+			try
+			{
+				exit_code = run_command(selected_mode, options, cli, db, daily_progress, false);
 			}
+			catch (const std::exception& e)
+			{
+				std::cout << "The command failed: " << e.what() << '\n';
+			}
+		}
+
+		if (exit_code == 0)
+			continue;
+
+		failed_count++;
+		std::cout << "Line " << line_number << " failed: " << line << '\n';
+
+		if (transactional)
+		{
+			std::cout << "Nothing was written to the database\n";
+			return 1;
+		}
+	}
+
+	db.write();
+	daily_progress.write();
+
+	std::cout << "Ran " << command_count << " commands, " << failed_count << " of them failed\n";
+	return failed_count == 0 ? 0 : 1;
+}
+
+/* Add the flips in a CSV or JSON lines file to the database */
+static i32 run_import(const std::string& file_path, const std::optional<transfer::format> file_format, db& db)
+{
+	// the server has its own copy of the database, which would get out of sync
+	if (server::is_running(file_paths::server_socket_file))
+	{
+		std::cout << "flip serve is running. Stop it before importing flips\n";
+		return 1;
+	}
+
+	std::ifstream file;
+	if (file_path != "-")
+	{
+		file.open(file_path, std::ios::binary);
+		if (!file.is_open())
+		{
+			std::cout << "Can't open " << file_path << '\n';
+			return 1;
 		}
 	}
 
+	std::istream& input = file_path == "-" ? std::cin : file;
+
+	const std::optional<transfer::import_result> result = transfer::import_flips(input, file_format.value_or(transfer::format_from_path(file_path)), db);
+	if (!result)
+	{
+		std::cout << "Nothing was imported\n";
+		return 1;
+	}
+
+	db.write();
+
+	std::cout << "Imported " << result->imported << " flips";
+	if (result->cancelled > 0)
+		std::cout << ", " << result->cancelled << " of them were marked as cancelled";
+	std::cout << '\n';
+
+	if (result->skipped > 0)
+		std::cout << result->skipped << " lines couldn't be imported\n";
+
+	return result->skipped == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	mode selected_mode = mode::tips;
+	options options;
+	const auto cli = make_cli(selected_mode, options);
+
+#ifndef FUZZING
+	const std::vector<std::string> cli_args(argv + 1, argv + argc);
+	if (!clipp::parse(cli_args.begin(), cli_args.end(), cli))
+	{
+		std::cout << "Invalid arguments were provided. Please check 'flip help'\n";
+		return 1;
+	}
+
+	// let the server run the command if there is one, so that the database doesn't need to be loaded
+	if (can_forward(selected_mode, options))
+	{
+		const std::optional<server::response> response = server::forward(file_paths::server_socket_file, cli_args);
+		if (response)
+		{
+			std::cout << response->output << std::flush;
+			return response->exit_code;
+		}
+	}
+#else
+	std::cout << "Fuzzing instrumentation is enabled. CLI args are read from stdin\n";
+	const std::vector<std::string> cli_args = flip_utils::split_command_line(std::string(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>()));
+
 	if (!clipp::parse(cli_args.begin(), cli_args.end(), cli))
 	{
 		std::cout << "Invalid arguments were provided. Please check 'flip help'\n";
@@ -160,6 +410,15 @@ int main(int argc, char** argv)
 	db db;
 	daily_progress daily_progress;
 
+	// use the weights found by the optimizer if there are any
+	load_v2_recommendation_weights(file_paths::v2_weights_file);
+
+	return run_command(selected_mode, options, cli, db, daily_progress, true);
+}
+
+template<typename cli_type>
+static i32 run_command(const mode selected_mode, const options& options, const cli_type& cli, db& db, daily_progress& daily_progress, const bool write_changes)
+{
 	switch (selected_mode)
 	{
 		case mode::tips:
@@ -167,7 +426,7 @@ int main(int argc, char** argv)
 			return 0;
 
 		case mode::optimize:
-			optimize_v2_recommendation_algorithm(db);
+			optimize_v2_recommendation_algorithm(db, options.optimize);
 			return 0;
 
 		case mode::calc:
@@ -195,15 +454,18 @@ int main(int argc, char** argv)
 		}
 
 		case mode::sold:
-			flips::sell(db, daily_progress, options.id, options.sell_price, options.item_count);
+			if (!flips::sell(db, daily_progress, options.id, options.sell_price, options.item_count))
+				return 1;
 			break;
 
 		case mode::cancel:
-			flips::cancel(db, options.id);
+			if (!flips::cancel(db, options.id))
+				return 1;
 			break;
 
 		case mode::update:
-			flips::update(db, options.id, options.buy_price, options.sell_price, options.item_count, options.account);
+			if (!flips::update(db, options.id, options.buy_price, options.sell_price, options.item_count, options.account))
+				return 1;
 			break;
 
 		case mode::list:
@@ -216,6 +478,8 @@ int main(int argc, char** argv)
 				flips::filter_name(db, options.item_name);
 			else if (options.flip_count > 0)
 				flips::filter_count(db, options.flip_count);
+			else if (!options.search_text.empty())
+				flips::filter_search(db, options.search_text);
 			else
 				std::cout << "Not really sure how to filter because no filters were defined\n";
 			return 0;
@@ -235,7 +499,8 @@ int main(int argc, char** argv)
 
 			// only update the daily progress and exit
 			// this is to update the daily reset if the day has changed
-			daily_progress.write();
+			if (write_changes)
+				daily_progress.write();
 			return 0;
 			break;
 		}
@@ -244,6 +509,53 @@ int main(int argc, char** argv)
 			flips::fix_stats(db);
 			break;
 
+		case mode::import_db:
+			return run_import(options.file_path, selected_transfer_format(options), db);
+
+		case mode::export_db:
+		{
+			const std::optional<transfer::format> file_format = selected_transfer_format(options);
+
+			if (!file_format)
+			{
+				if (options.file_path.empty())
+					std::cout << std::setw(4) << db.to_json() << '\n';
+				else
+					flip_utils::write_json_file(db.to_json(), options.file_path);
+				return 0;
+			}
+
+			if (options.file_path.empty())
+			{
+				transfer::export_flips(db, *file_format, std::cout);
+				return 0;
+			}
+
+			std::ofstream file(options.file_path, std::ios::binary);
+			if (file.is_open())
+				transfer::export_flips(db, *file_format, file);
+
+			if (!file.is_open() || !file)
+			{
+				std::cout << "Couldn't write the flips to " << options.file_path << '\n';
+				return 1;
+			}
+
+			return 0;
+		}
+
+		case mode::batch:
+			return run_batch(options.file_path, options.transactional, db, daily_progress);
+
+		case mode::serve:
+			return server::serve(file_paths::server_socket_file, [&db](const std::vector<std::string>& args) {
+				return run_forwarded_command(args, db);
+			});
+
+		case mode::bench:
+			benchmark::run();
+			return 0;
+
 		case mode::help:
 		{
 			auto fmt = clipp::doc_formatting{}.doc_column(30);
@@ -260,6 +572,11 @@ int main(int argc, char** argv)
 
 	/* Update the database files
 	 * If no update is required, exit early */
-	db.write();
-	daily_progress.write();
+	if (write_changes)
+	{
+		db.write();
+		daily_progress.write();
+	}
+
+	return 0;
 }
@@ -0,0 +1,273 @@
+#include "FlipUtils.hpp"
+#include "OpLog.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <doctest/doctest.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <unistd.h>
+
+constexpr char LOG_MAGIC[8] = { 'R', 'S', 'F', 'L', 'I', 'P', 'L', 'G' };
+constexpr u32 LOG_VERSION = 1;
+
+struct log_header
+{
+	char magic[8];
+	u32 version;
+	u32 reserved;
+	u64 generation;
+};
+
+static_assert(sizeof(log_header) == 24);
+
+struct record_header
+{
+	u32 size;
+	u32 checksum;
+};
+
+static u32 checksum(const char* data, const size_t size)
+{
+	u32 hash = 0x811c9dc5;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= static_cast<u8>(data[i]);
+		hash *= 0x01000193;
+	}
+	return hash;
+}
+
+void op_log::record::put(const std::string& str)
+{
+	put<u32>(str.size());
+	payload.append(str);
+}
+
+const std::string& op_log::record::data() const
+{
+	return payload;
+}
+
+op_log::record_reader::record_reader(std::string_view payload)
+:payload(payload)
+{}
+
+bool op_log::record_reader::get(std::string& str)
+{
+	u32 length;
+	if (!get(length) || payload.size() - offset < length)
+		return false;
+
+	str = payload.substr(offset, length);
+	offset += length;
+	return true;
+}
+
+bool op_log::record_reader::at_end() const
+{
+	return offset == payload.size();
+}
+
+op_log::op_log(const std::string& file_path)
+:file_path(file_path)
+{}
+
+std::vector<std::string> op_log::open(const u64 generation)
+{
+	std::vector<std::string> records;
+	staged.clear();
+
+	const std::string bytes = std::filesystem::exists(file_path) ? flip_utils::read_file(file_path) : "";
+
+	log_header header;
+	if (bytes.size() < sizeof(log_header))
+	{
+		reset(generation);
+		return records;
+	}
+
+	std::memcpy(&header, bytes.data(), sizeof(log_header));
+
+	/* The log has already been checkpointed into the database or it is garbage */
+	if (std::memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 || header.version != LOG_VERSION || header.generation != generation)
+	{
+		reset(generation);
+		return records;
+	}
+
+	size_t offset = sizeof(log_header);
+	while (bytes.size() - offset >= sizeof(record_header))
+	{
+		record_header record;
+		std::memcpy(&record, bytes.data() + offset, sizeof(record_header));
+
+		const size_t payload_offset = offset + sizeof(record_header);
+		if (bytes.size() - payload_offset < record.size)
+			break;
+
+		if (checksum(bytes.data() + payload_offset, record.size) != record.checksum)
+			break;
+
+		records.emplace_back(bytes.substr(payload_offset, record.size));
+		offset = payload_offset + record.size;
+	}
+
+	/* Drop a partially written record so that new records don't end up behind it */
+	if (offset != bytes.size())
+	{
+		std::cout << "Warning: dropping an incomplete entry from the end of the operation log\n";
+		std::filesystem::resize_file(file_path, offset);
+	}
+
+	committed_size = offset;
+
+	return records;
+}
+
+void op_log::stage(const record& record)
+{
+	const std::string& payload = record.data();
+
+	record_header header;
+	header.size = payload.size();
+	header.checksum = checksum(payload.data(), payload.size());
+
+	staged.append(reinterpret_cast<const char*>(&header), sizeof(record_header));
+	staged.append(payload);
+}
+
+void op_log::commit()
+{
+	if (staged.empty())
+		return;
+
+	assert(committed_size >= sizeof(log_header) && "the log needs to be opened before committing");
+
+	const int fd = ::open(file_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd < 0 || !flip_utils::write_fd(fd, staged) || fsync(fd) != 0)
+	{
+		std::cout << "Couldn't write to the operation log " << file_path << ": " << std::strerror(errno) << '\n';
+		exit(1);
+	}
+
+	close(fd);
+
+	committed_size += staged.size();
+	staged.clear();
+}
+
+void op_log::discard()
+{
+	staged.clear();
+}
+
+bool op_log::has_staged() const
+{
+	return !staged.empty();
+}
+
+void op_log::reset(const u64 generation)
+{
+	log_header header;
+	std::memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+	header.version = LOG_VERSION;
+	header.reserved = 0;
+	header.generation = generation;
+
+	if (!flip_utils::write_file_durable(file_path, std::string(reinterpret_cast<const char*>(&header), sizeof(log_header))))
+	{
+		std::cout << "Couldn't reset the operation log " << file_path << '\n';
+		exit(1);
+	}
+
+	committed_size = sizeof(log_header);
+}
+
+size_t op_log::size() const
+{
+	return committed_size;
+}
+
+TEST_CASE("Operation log")
+{
+	const std::string log_path = std::filesystem::temp_directory_path() / ("rs-flip-oplog-test-" + std::to_string(getpid()));
+	std::filesystem::remove(log_path);
+
+	op_log log(log_path);
+	CHECK(log.open(1).empty());
+	const size_t empty_size = log.size();
+
+	op_log::record first;
+	first.put<u8>(3);
+	first.put<i64>(-1'000'000'000'000);
+	first.put(std::string("Iron bar"));
+
+	op_log::record second;
+	second.put<u32>(42);
+
+	log.stage(first);
+	log.stage(second);
+	CHECK(log.has_staged());
+	log.commit();
+	CHECK_FALSE(log.has_staged());
+	CHECK(log.size() > empty_size);
+
+	SUBCASE("Records are read back in order")
+	{
+		op_log reopened(log_path);
+		const std::vector<std::string> records = reopened.open(1);
+		REQUIRE(records.size() == 2);
+
+		op_log::record_reader reader(records[0]);
+		u8 op{};
+		i64 value{};
+		std::string item;
+		CHECK(reader.get(op));
+		CHECK(reader.get(value));
+		CHECK(reader.get(item));
+		CHECK(reader.at_end());
+		CHECK(op == 3);
+		CHECK(value == -1'000'000'000'000);
+		CHECK(item == "Iron bar");
+
+		u64 too_big;
+		op_log::record_reader short_reader(records[1]);
+		CHECK_FALSE(short_reader.get(too_big));
+	}
+
+	SUBCASE("Discarded records are not written")
+	{
+		log.stage(first);
+		log.discard();
+		log.commit();
+
+		op_log reopened(log_path);
+		CHECK(reopened.open(1).size() == 2);
+	}
+
+	SUBCASE("A log from another generation is not replayed")
+	{
+		op_log reopened(log_path);
+		CHECK(reopened.open(2).empty());
+		CHECK(reopened.size() == empty_size);
+	}
+
+	SUBCASE("A torn record at the end is dropped")
+	{
+		std::filesystem::resize_file(log_path, std::filesystem::file_size(log_path) - 2);
+
+		op_log reopened(log_path);
+		CHECK(reopened.open(1).size() == 1);
+
+		/* New records can be appended after the intact ones */
+		reopened.stage(second);
+		reopened.commit();
+
+		op_log again(log_path);
+		CHECK(again.open(1).size() == 2);
+	}
+
+	std::filesystem::remove(log_path);
+}
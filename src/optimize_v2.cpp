@@ -1,241 +1,619 @@
 #include "AvgStat.hpp"
+#include "FilePaths.hpp"
 #include "Optimize_v2.hpp"
 #include "Random.hpp"
 #include "Recommendations.hpp"
+#include "Simulator.hpp"
 #include "Stats.hpp"
 
+#include <atomic>
+#include <csignal>
+#include <doctest/doctest.h>
+#include <execution>
+#include <filesystem>
 #include <iostream>
-
-f64 reward_function(const std::vector<stats::avg_stat>& sorted_flips, class random& rng);
-
-void optimize_v2_recommendation_algorithm(const db& db)
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <optional>
+#include <thread>
+
+// how many simulated runs a thread processes in lockstep
+constexpr u16 runs_per_batch = 16;
+
+// pre-generated cancellation draws for a fixed set of simulated scenarios
+//
+// evaluating all of the candidate weights on the same scenarios (common random
+// numbers) makes the rewards directly comparable, so far fewer simulations are
+// needed and the improvements aren't just lucky draws
+class simulation_scenarios
 {
-	if (db.total_flip_count() < 200)
+public:
+	simulation_scenarios(const u16 count, const u64 seed, const simulator::config& settings)
+	:scenario_count(count), hours(settings.hours), top_flip_count(settings.top_flip_count), draws(static_cast<size_t>(count) * hours * top_flip_count)
 	{
-		std::cout << "the amount of flips is too low to even attempt optimizing anything\n";
-		return;
+		for (u16 scenario = 0; scenario < count; ++scenario)
+		{
+			class random rng;
+			rng.seed(random::stream_seed(seed, scenario));
+
+			rng.fill_uniform(std::span<f32>(draws.data() + static_cast<size_t>(scenario) * hours * top_flip_count, static_cast<size_t>(hours) * top_flip_count));
+		}
 	}
 
-	// some initialization stuff
-	stats::avg_stat::set_recommendation_algorithm(2);
-	const std::vector<stats::avg_stat> raw_flips = db.get_flip_avg_stats();
+	u16 count() const
+	{
+		return scenario_count;
+	}
 
-	// filter out flips with lacking data
-	constexpr u8 min_flip_data = 4;
-	std::vector<stats::avg_stat> flips;
-	for (const stats::avg_stat& flip : raw_flips)
+	// the random value that decides if the flip at a rank gets cancelled
+	f32 cancellation_draw(const u16 scenario, const u8 hour, const u8 rank) const
 	{
-		if (flip.flip_count() >= min_flip_data)
-			flips.push_back(flip);
+		assert(scenario < scenario_count);
+		assert(hour < hours && rank < top_flip_count);
+		return draws[(static_cast<size_t>(scenario) * hours + hour) * top_flip_count + rank];
 	}
 
-	assert(!flips.empty());
+private:
+	u16 scenario_count;
+	u8 hours;
+	u8 top_flip_count;
+	std::vector<f32> draws;
+};
 
-	class random rng;
+// the average profit of simulated flipping with the ranked flips
+// the same seed always gives the same result
+f64 reward_function(const stats::avg_stat_table& flips, const std::vector<u32>& ranking, const simulator::config& settings, const u64 seed);
 
-	constexpr u8 initial_info_text_width = 36;
+// the average profit of the simulated scenarios with the ranked flips
+f64 reward_function(const stats::avg_stat_table& flips, const std::vector<u32>& ranking, const simulator::config& settings, const simulation_scenarios& scenarios);
 
-	// check what the reward value would be with the current weights
-	// this should be good for checking if the newly generated weights are better ones
-	{
-		stats::sort_flips_by_recommendation_direct(flips);
-		const f64 reward = reward_function(flips, rng);
-		std::cout << std::left << std::setw(initial_info_text_width) << "profit with current weights: " << flip_utils::round_big_numbers(reward) << '\n';
-	}
+// the simulation settings are saved to the checkpoint as an array
+static nlohmann::json simulation_settings_to_json(const simulator::config& settings)
+{
+	return { settings.hours, settings.slot_count, settings.top_flip_count, settings.cooldown, settings.cancelled_cooldown };
+}
 
-	// reset all weights to even values
-	// the weight array is stored in Recommendations.hpp
-	for (size_t i = 0; i < v2_recommendation_algorithm_weights.size(); ++i)
-		v2_recommendation_algorithm_weights[i] = 1.0 / v2_recommendation_algorithm_weights.size();
+static simulator::config simulation_settings_from_json(const nlohmann::json& json)
+{
+	const std::array<u8, 5> values = json.get<std::array<u8, 5>>();
+	return { values[0], values[1], values[2], values[3], values[4] };
+}
 
-	// measure the margin of error with a few runs
-	const f64 margin_of_error = [&flips, &rng]() -> f64
+// returns false if the simulation can't be run with the settings
+static bool validate_simulation_settings(const simulator::config& settings)
+{
+	return settings.hours > 0 && settings.slot_count > 0 && settings.top_flip_count > 0 && settings.top_flip_count <= simulator::max_top_flip_count;
+}
+
+// the best weights found so far, shared by all of the search threads
+struct search_state
+{
+	std::mutex mutex;
+	f64 best_reward{0};
+	std::array<f64, v2_variable_count> best_weights{};
+	size_t iteration{0};
+	size_t last_new_best_time{0};
+	bool explore{true};
+
+	// random number streams of the search threads. These are only used while
+	// holding the mutex, so that they can be checkpointed at any time
+	std::vector<class random> rngs;
+
+	// candidates that have been picked for evaluation
+	size_t started_iterations{0};
+
+	// when to stop searching. Zero means no limit
+	size_t max_iterations{0};
+	size_t deadline{0};
+	bool stop{false};
+
+	// the values that stay the same for the whole search
+	nlohmann::json checkpoint_base;
+	size_t last_checkpoint_time{0};
+};
+
+// set when the user presses Ctrl-C, so that the search can be stopped cleanly
+static std::atomic<bool> interrupted{false};
+
+static void handle_interrupt(int)
+{
+	interrupted = true;
+}
+
+// write the search progress to the checkpoint file
+// the search state needs to be locked
+static void write_checkpoint(search_state& state)
+{
+	nlohmann::json checkpoint = state.checkpoint_base;
+	checkpoint["best_reward"] = state.best_reward;
+	checkpoint["best_weights"] = state.best_weights;
+	checkpoint["iteration"] = state.iteration;
+	checkpoint["explore"] = state.explore;
+
+	checkpoint["rng_states"] = nlohmann::json::array();
+	for (const class random& rng : state.rngs)
+		checkpoint["rng_states"].push_back(rng.state());
+
+	if (!flip_utils::write_file_durable(file_paths::optimizer_checkpoint_file, checkpoint.dump(4) + '\n'))
+		std::cout << "\nCouldn't write the checkpoint to " << file_paths::optimizer_checkpoint_file << '\n';
+
+	state.last_checkpoint_time = time(0);
+}
+
+// randomly tweak the weights and normalize them so that they sum up to one
+// returns false if the weights can't be normalized
+static bool tweak_weights(std::array<f64, v2_variable_count>& weights, const bool explore, class random& rng)
+{
+	const u8 strategy = explore ? 2 : 8;
+
+	if (rng.next() % strategy != 0)
 	{
-		std::vector<f64> profits;
-		constexpr u16 margin_of_error_round_count = 1000;
-		for (u16 i = 0; i < margin_of_error_round_count; ++i)
+		// tweak a random amount of variables by a random amount
+		// this can tweak the same variable multiple times, thus multiplying the effect
+		const u8 vars_to_tweak = rng.range(1, v2_variable_count - 1);
+
+		for (u8 i = 0; i < vars_to_tweak; ++i)
 		{
-			const f64 profit = reward_function(flips, rng);
-			profits.push_back(profit);
+			const u8 index = rng.next() % v2_variable_count;
+			f64& weight = weights[index];
+
+			// multiplying very small values doesn't really make a difference, so use
+			// addition with those
+			if (weight > 0.1)
+				weight *= rng.range_float(0.9f, 1.1f);
+			else
+				weight += rng.range_float(0.001f, 0.1f);
 		}
+	}
+	else
+	{
+		for (u8 j = 0; j < v2_variable_count; ++j)
+			weights[j] = rng.range_float(0.0f, 1.0f);
+	}
 
-		const f64 min = *std::min_element(profits.begin(), profits.end());
-		const f64 max = *std::max_element(profits.begin(), profits.end());
-		std::cout << std::setw(initial_info_text_width) << "margin of error: " << flip_utils::round_big_numbers(max - min) << '\n';
-		return max - min;
-	}();
+	// make sure that the weights sum up to one
+	f64 weight_sum{0};
+	for (size_t k = 0; k < v2_variable_count; ++k)
+		weight_sum += weights[k];
 
-	// start cooking the numbers
-	f64 best_reward = reward_function(stats::sort_flips_by_recommendation(flips), rng);
-	std::array<f64, v2_variable_count> best_weights = v2_recommendation_algorithm_weights;
-	std::cout << std::left << std::setw(initial_info_text_width) << "starting profit with even weights: " << flip_utils::round_big_numbers(best_reward) << '\n';
+	if (weight_sum == 0.0)
+		return false;
 
-	// use the right alignment for the result printing
-	std::cout << std::right;
-	size_t i{0};
+	for (f64& weight : weights)
+		weight /= weight_sum;
 
-	// start out by exploring different random options and then start improving
-	// the best result that could be found while still slowly exploring some
-	// other random options
-	size_t last_new_best_time = time(0);
-	bool explore = true;
+	return true;
+}
 
-	// TODO: throw multithreading at the problem, its too slow :(
+// keep trying out variations of the best weights found so far by any of the threads
+static void search_weights(const stats::avg_stat_table& flips, const v2_feature_matrix& feature_matrix, const simulator::config& simulation, const std::optional<simulation_scenarios>& scenarios, const f64 margin_of_error, search_state& state, const u32 thread_index)
+{
+	// how often the progress is saved
+	constexpr u32 checkpoint_interval_seconds = 60;
+
+	std::vector<f64> scores;
+	std::vector<u32> ranking;
+	std::array<f64, v2_variable_count> weights;
 
 	while (true)
 	{
-		const u8 strategy = explore ? 2 : 8;
+		u64 evaluation_seed;
+
+		{
+			std::lock_guard<std::mutex> lock(state.mutex);
+
+			if (interrupted || (state.deadline != 0 && static_cast<size_t>(time(0)) >= state.deadline))
+				state.stop = true;
+
+			if (state.stop || (state.max_iterations != 0 && state.started_iterations >= state.max_iterations))
+				break;
+
+			weights = state.best_weights;
+			if (!tweak_weights(weights, state.explore, state.rngs[thread_index]))
+				continue;
+
+			evaluation_seed = state.rngs[thread_index].next();
+			state.started_iterations++;
+		}
+
+		feature_matrix.rank(weights, scores, ranking, simulation.top_flip_count);
+		const f64 reward = scenarios ? reward_function(flips, ranking, simulation, *scenarios) : reward_function(flips, ranking, simulation, evaluation_seed);
+
+		std::lock_guard<std::mutex> lock(state.mutex);
+		const size_t i = state.iteration++;
+
+		if (static_cast<size_t>(time(0)) - state.last_checkpoint_time >= checkpoint_interval_seconds)
+			write_checkpoint(state);
 
 		// print progress and check if the strategy should be changed
 		if (i % 64 == 0)
 		{
 			constexpr u32 explore_threshold_seconds = 15 * 60;
 			const size_t cur_time = time(0);
-			const size_t elapsed_time = cur_time - last_new_best_time;
+			const size_t elapsed_time = cur_time - state.last_new_best_time;
 
 			if (elapsed_time > explore_threshold_seconds)
-				explore = false;
+				state.explore = false;
 
-			std::cout << "\riteration: " << i << " (" << ( explore ? "explore" : "exploit" ) << ")" << std::flush;
+			std::cout << "\riteration: " << i << " (" << ( state.explore ? "explore" : "exploit" ) << ")" << std::flush;
 		}
 
-		// randomly tweak the weights
-		if (rng.next() % strategy != 0)
-		{
-			// tweak a random amount of variables by a random amount
-			// this can tweak the same variable multiple times, thus multiplying the effect
-			const u8 vars_to_tweak = rng.range(1, v2_variable_count - 1);
+		// only consider the reward being higher, if the difference is higher than the margin
+		// of error. Another thread might've found better weights in the meantime, so the
+		// comparison is done against the latest best reward
+		if (reward - margin_of_error <= state.best_reward)
+			continue;
 
-			for (u8 i = 0; i < vars_to_tweak; ++i)
-			{
-				const u8 index = rng.next() % v2_variable_count;
-				f64& weight = v2_recommendation_algorithm_weights[index];
-
-				// multiplying very small values doesn't really make a difference, so use
-				// addition with those
-				if (weight > 0.1)
-					weight *= rng.range_float(0.9f, 1.1f);
-				else
-					weight += rng.range_float(0.001f, 0.1f);
-			}
-		}
-		else
+		state.best_reward = reward;
+		state.best_weights = weights;
+		state.last_new_best_time = time(0);
+		std::cout << "\r" << std::setw(7) << i << " | " << std::setw(8) << flip_utils::round_big_numbers(state.best_reward) << " | ";
+
+		// print the weights
+		std::cout << "{ ";
+		for (u8 v = 0; v < v2_variable_count; ++v)
 		{
-			for (u8 j = 0; j < v2_variable_count; ++j)
-				v2_recommendation_algorithm_weights[j] = rng.range_float(0.0f, 1.0f);
+			std::cout << weights[v];
+			if (v != v2_variable_count - 1)
+				std::cout << ", ";
 		}
+		std::cout << " }\n";
+	}
+}
 
-		// make sure that the weights sum up to one
-		f64 weight_sum{0};
-		for (size_t k = 0; k < v2_variable_count; ++k)
-			weight_sum += v2_recommendation_algorithm_weights[k];
+// continue the search from the checkpoint file
+// returns false if there's no checkpoint that could be used
+static bool load_checkpoint(search_state& state, const size_t flip_count)
+{
+	if (!std::filesystem::exists(file_paths::optimizer_checkpoint_file))
+	{
+		std::cout << "there is no checkpoint to resume from\n";
+		return false;
+	}
 
-		if (weight_sum == 0.0)
-			continue;
+	try
+	{
+		const nlohmann::json checkpoint = nlohmann::json::parse(flip_utils::read_file(file_paths::optimizer_checkpoint_file));
 
-		for (f64& weight : v2_recommendation_algorithm_weights)
-			weight /= weight_sum;
+		if (checkpoint.at("flip_count").get<size_t>() != flip_count)
+		{
+			std::cout << "the flips have changed since the checkpoint was saved, start a new search instead\n";
+			return false;
+		}
 
-		stats::sort_flips_by_recommendation_direct(flips);
-		const f64 reward = reward_function(flips, rng);
+		state.best_reward = checkpoint.at("best_reward").get<f64>();
+		state.best_weights = checkpoint.at("best_weights").get<std::array<f64, v2_variable_count>>();
+		state.iteration = checkpoint.at("iteration").get<size_t>();
+		state.explore = checkpoint.at("explore").get<bool>();
 
-		// if the reward is lower than before, set the weights back to the previous ones
-		// only consider the reward being higher, if the difference is higher than the margin
-		// of error
-		if (reward - margin_of_error <= best_reward)
+		for (const nlohmann::json& rng_state : checkpoint.at("rng_states"))
 		{
-			v2_recommendation_algorithm_weights = best_weights;
+			state.rngs.emplace_back();
+			if (!state.rngs.back().set_state(rng_state.get<std::string>()))
+				throw std::runtime_error("invalid random number generator state");
 		}
-		else
+
+		state.checkpoint_base = checkpoint;
+		for (const char* key : { "best_reward", "best_weights", "iteration", "explore", "rng_states" })
+			state.checkpoint_base.erase(key);
+
+		// make sure that the rest of the values are there too
+		checkpoint.at("seed").get<u64>();
+		checkpoint.at("scenario_count").get<u16>();
+		checkpoint.at("scenario_seed").get<u64>();
+		simulation_settings_from_json(checkpoint.at("simulation"));
+		checkpoint.at("margin_of_error").get<f64>();
+		checkpoint.at("current_reward").get<f64>();
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "the checkpoint " << file_paths::optimizer_checkpoint_file << " can't be used: " << e.what() << '\n';
+		return false;
+	}
+
+	return true;
+}
+
+void optimize_v2_recommendation_algorithm(const db& db, const optimize_config& config)
+{
+	if (db.total_flip_count() < 200)
+	{
+		std::cout << "the amount of flips is too low to even attempt optimizing anything\n";
+		return;
+	}
+
+	// zero threads means all of the cores
+	const u32 thread_count = config.thread_count == 0 ? std::max(1u, std::thread::hardware_concurrency()) : config.thread_count;
+
+	// some initialization stuff
+	const stats::avg_stat_table raw_flips = db.get_flip_stat_table();
+
+	// the values are normalized over all of the items like they are for the tips
+	const stats::scoring_context context(raw_flips);
+
+	// filter out flips with lacking data
+	constexpr u8 min_flip_data = 4;
+	std::vector<u32> flip_indices;
+	for (u32 i = 0; i < raw_flips.size(); ++i)
+	{
+		if (raw_flips[i].flip_count() >= min_flip_data)
+			flip_indices.push_back(i);
+	}
+
+	const stats::avg_stat_table flips = raw_flips.subset(flip_indices);
+
+	assert(!flips.empty());
+
+	search_state state;
+	if (config.resume && !load_checkpoint(state, db.total_flip_count()))
+		return;
+
+	// everything random is derived from a single seed, so that runs can be repeated
+	class random rng;
+	const u64 seed = config.resume ? state.checkpoint_base["seed"].get<u64>() : config.fixed_seed ? config.seed : rng.next();
+	rng.seed(seed);
+
+	const u16 scenario_count = config.resume ? state.checkpoint_base["scenario_count"].get<u16>() : config.scenario_count;
+	const u64 scenario_seed = config.resume ? state.checkpoint_base["scenario_seed"].get<u64>() : rng.next();
+
+	const simulator::config simulation = config.resume ? simulation_settings_from_json(state.checkpoint_base["simulation"]) : config.simulation;
+	if (!validate_simulation_settings(simulation))
+	{
+		std::cout << "the simulation settings are not valid\n";
+		return;
+	}
+
+	std::optional<simulation_scenarios> scenarios;
+	if (scenario_count != 0)
+		scenarios.emplace(scenario_count, scenario_seed, simulation);
+
+	const auto evaluate = [&flips, &simulation, &scenarios, &rng](const std::vector<u32>& ranking) -> f64
+	{
+		return scenarios ? reward_function(flips, ranking, simulation, *scenarios) : reward_function(flips, ranking, simulation, rng.next());
+	};
+
+	// only the weights change between iterations, so the rest of the
+	// recommendation algorithm can be calculated beforehand
+	const v2_feature_matrix feature_matrix(flips, context);
+	std::vector<f64> scores;
+	std::vector<u32> ranking;
+
+	constexpr u8 initial_info_text_width = 36;
+
+	std::cout << std::left << std::setw(initial_info_text_width) << "seed: " << seed << '\n';
+
+	f64 current_reward;
+	f64 margin_of_error;
+
+	if (config.resume)
+	{
+		current_reward = state.checkpoint_base["current_reward"].get<f64>();
+		margin_of_error = state.checkpoint_base["margin_of_error"].get<f64>();
+
+		std::cout << std::setw(initial_info_text_width) << "resuming from iteration: " << state.iteration << '\n';
+		std::cout << std::setw(initial_info_text_width) << "profit with current weights: " << flip_utils::round_big_numbers(current_reward) << '\n';
+		std::cout << std::setw(initial_info_text_width) << "best profit so far: " << flip_utils::round_big_numbers(state.best_reward) << '\n';
+	}
+	else
+	{
+		// check what the reward value would be with the current weights
+		// this should be good for checking if the newly generated weights are better ones
+		feature_matrix.rank(context.weights, scores, ranking, simulation.top_flip_count);
+		current_reward = evaluate(ranking);
+		std::cout << std::setw(initial_info_text_width) << "profit with current weights: " << flip_utils::round_big_numbers(current_reward) << '\n';
+
+		// start from even weights
+		std::array<f64, v2_variable_count> even_weights;
+		even_weights.fill(1.0 / v2_variable_count);
+
+		// measure the margin of error with a few runs
+		// with common random numbers the same weights always get the same reward, so there's nothing to measure
+		feature_matrix.rank(even_weights, scores, ranking, simulation.top_flip_count);
+		margin_of_error = scenarios ? 0.0 : [&flips, &ranking, &simulation, &rng]() -> f64
 		{
-			best_reward = reward;
-			best_weights = v2_recommendation_algorithm_weights;
-			last_new_best_time = time(0);
-			std::cout << "\r" << std::setw(7) << i << " | " << std::setw(8) << flip_utils::round_big_numbers(best_reward) << " | ";
-
-			// print the weights
-			std::cout << "{ ";
-			for (u8 v = 0; v < v2_variable_count; ++v)
+			std::vector<f64> profits;
+			constexpr u16 margin_of_error_round_count = 1000;
+			for (u16 i = 0; i < margin_of_error_round_count; ++i)
 			{
-				std::cout << v2_recommendation_algorithm_weights[v];
-				if (v != v2_variable_count - 1)
-					std::cout << ", ";
+				const f64 profit = reward_function(flips, ranking, simulation, rng.next());
+				profits.push_back(profit);
 			}
-			std::cout << " }\n";
-		}
 
-		i++;
+			const f64 min = *std::min_element(profits.begin(), profits.end());
+			const f64 max = *std::max_element(profits.begin(), profits.end());
+			std::cout << std::setw(initial_info_text_width) << "margin of error: " << flip_utils::round_big_numbers(max - min) << '\n';
+			return max - min;
+		}();
+
+		// start cooking the numbers
+		state.best_reward = evaluate(ranking);
+		state.best_weights = even_weights;
+		std::cout << std::setw(initial_info_text_width) << "starting profit with even weights: " << flip_utils::round_big_numbers(state.best_reward) << '\n';
+
+		state.checkpoint_base["flip_count"] = db.total_flip_count();
+		state.checkpoint_base["seed"] = seed;
+		state.checkpoint_base["scenario_count"] = scenario_count;
+		state.checkpoint_base["scenario_seed"] = scenario_seed;
+		state.checkpoint_base["simulation"] = simulation_settings_to_json(simulation);
+		state.checkpoint_base["margin_of_error"] = margin_of_error;
+		state.checkpoint_base["current_reward"] = current_reward;
+	}
+
+	// each search thread has its own part of a random number stream, one jump apart
+	// threads that weren't there when the checkpoint was saved get new streams
+	class random search_rng;
+	search_rng.seed(random::stream_seed(seed, state.iteration));
+	for (u32 t = 0; t < thread_count; ++t)
+	{
+		if (t >= state.rngs.size())
+			state.rngs.push_back(search_rng);
+
+		search_rng.jump();
+	}
+
+	std::cout << std::setw(initial_info_text_width) << "search threads: " << thread_count << '\n';
+
+	if (scenarios)
+		std::cout << std::setw(initial_info_text_width) << "common random number scenarios: " << scenarios->count() << '\n';
+
+	state.started_iterations = state.iteration;
+	state.max_iterations = config.max_iterations;
+	if (config.time_budget != 0)
+		state.deadline = time(0) + config.time_budget;
+
+	// use the right alignment for the result printing
+	std::cout << std::right;
+
+	// start out by exploring different random options and then start improving
+	// the best result that could be found while still slowly exploring some
+	// other random options
+	state.last_new_best_time = time(0);
+	state.last_checkpoint_time = time(0);
+
+	// Ctrl-C stops the search after the candidates that are being evaluated
+	interrupted = false;
+	const auto previous_interrupt_handler = std::signal(SIGINT, handle_interrupt);
+
+	// every thread evaluates its own candidates and shares the improvements
+	// with the others through the search state
+	std::vector<std::thread> threads;
+	for (u32 t = 1; t < thread_count; ++t)
+		threads.emplace_back(search_weights, std::cref(flips), std::cref(feature_matrix), std::cref(simulation), std::cref(scenarios), margin_of_error, std::ref(state), t);
+
+	search_weights(flips, feature_matrix, simulation, scenarios, margin_of_error, state, 0);
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	std::signal(SIGINT, previous_interrupt_handler);
+
+	write_checkpoint(state);
+
+	std::cout << std::left << "\n\n" << std::setw(initial_info_text_width) << "iterations: " << state.iteration << '\n';
+	std::cout << std::setw(initial_info_text_width) << "best profit: " << flip_utils::round_big_numbers(state.best_reward) << '\n';
+	std::cout << "progress saved to " << file_paths::optimizer_checkpoint_file << ", continue with --resume\n";
+
+	// keep the new weights only if they beat the current ones
+	if (state.best_reward - margin_of_error > current_reward)
+	{
+		v2_recommendation_algorithm_weights = state.best_weights;
+		save_v2_recommendation_weights(state.best_weights, file_paths::v2_weights_file);
+		std::cout << "the new weights were saved to " << file_paths::v2_weights_file << '\n';
+	}
+	else
+	{
+		std::cout << "the new weights weren't better than the current ones\n";
 	}
 }
 
-f64 reward_function(const std::vector<stats::avg_stat>& sorted_flips, class random& rng)
+// simulate the runs in batches in parallel
+// batch(first_run, profits) simulates the runs starting from first_run
+template<typename F>
+static void simulate_batches(const u16 run_count, std::vector<f64>& profits, F&& batch)
+{
+	profits.resize(run_count);
+
+	std::vector<u16> first_runs;
+	for (u16 first_run = 0; first_run < run_count; first_run += std::min<u16>(runs_per_batch, run_count - first_run))
+		first_runs.push_back(first_run);
+
+	std::for_each(std::execution::par, first_runs.begin(), first_runs.end(), [&](const u16 first_run) {
+		const u16 count = std::min<u16>(runs_per_batch, run_count - first_run);
+		batch(first_run, std::span<f64>(profits.data() + first_run, count));
+	});
+}
+
+f64 reward_function(const stats::avg_stat_table& flips, const std::vector<u32>& ranking, const simulator::config& settings, const u64 seed)
 {
 	// run a simulations with the flip recommendations
 
 	constexpr u16 simulation_repetitions = 500;
-	constexpr u8 hours = 48;
-	constexpr u8 cooldown_duration = 4;
-	constexpr u8 top_flip_count = 50;
-	assert(sorted_flips.size() >= top_flip_count);
+	const simulator::ranked_flips ranked(flips, ranking, settings);
+
+	// the repetitions are independent of each other, so they can be run in parallel
+	// each repetition has its own random number stream derived from the seed and
+	// the results are summed in the repetition order, so the thread count doesn't
+	// affect the result
+	std::vector<f64> repetition_profits;
+	simulate_batches(simulation_repetitions, repetition_profits, [&](const u16 first_repetition, std::span<f64> profits) {
+		std::array<class random, runs_per_batch> rngs;
+		for (u16 r = 0; r < profits.size(); ++r)
+			rngs[r].seed(random::stream_seed(seed, first_repetition + r));
+
+		simulator::run(settings, ranked, profits, [&rngs](const size_t r, u32, u8) { return rngs[r].range_float(0.0f, 1.0f); });
+	});
+
+	f64 repetition_total_profit{0};
+	for (const f64 profit : repetition_profits)
+		repetition_total_profit += profit;
+
+	return repetition_total_profit / simulation_repetitions;
+}
+
+f64 reward_function(const stats::avg_stat_table& flips, const std::vector<u32>& ranking, const simulator::config& settings, const simulation_scenarios& scenarios)
+{
+	assert(scenarios.count() > 0);
 
-	const auto simulation_run = [&sorted_flips, &rng]() -> f64
+	const simulator::ranked_flips ranked(flips, ranking, settings);
+
+	std::vector<f64> scenario_profits;
+	simulate_batches(scenarios.count(), scenario_profits, [&](const u16 first_scenario, std::span<f64> profits) {
+		simulator::run(settings, ranked, profits, [&scenarios, first_scenario](const size_t r, const u32 hour, const u8 rank) {
+			return scenarios.cancellation_draw(first_scenario + r, hour, rank);
+		});
+	});
+
+	f64 total_profit{0};
+	for (const f64 profit : scenario_profits)
+		total_profit += profit;
+
+	return total_profit / scenarios.count();
+}
+
+TEST_CASE("Simulation reward is reproducible")
+{
+	std::vector<stats::avg_stat> stats;
+	std::vector<u32> ranking;
+
+	const simulator::config settings;
+
+	for (u32 i = 0; i < settings.top_flip_count; ++i)
 	{
-		f64 total_profit{0};
-		std::array<u8, top_flip_count> buy_limit_cooldowns{0};
+		stats::avg_stat stat("Item " + std::to_string(i));
+		for (u32 j = 0; j < 5; ++j)
+			stat.add_data(1000 * i + j * 17, 1, 100, i * 5 + j);
 
-		for (u8 hour = 0; hour < hours; ++hour)
-		{
-			// find 8 items (ge slot count) that are not on a cooldown
-			constexpr u8 max_concurrent_flip_count = 8;
-			u8 flipped_item_count{0};
+		// some of the flips get cancelled in the simulation
+		for (u32 j = 0; j < i % 4; ++j)
+			stat.inc_cancel_count();
 
-			for (size_t i = 0; i < sorted_flips.size() && i < top_flip_count && flipped_item_count < max_concurrent_flip_count; ++i)
-			{
-				if (buy_limit_cooldowns.at(i) > 0)
-					continue;
-
-				// check if the flip was cancelled
-				// still give the item a cooldown, since it wouldn't make sense to
-				// flip it again right after and waste more time
-				//
-				// also make the cooldown slightly longer
-				const bool got_cancelled = rng.range_float(0.0f, 1.0f) < sorted_flips[i].cancellation_ratio();
-				if (got_cancelled)
-				{
-					buy_limit_cooldowns[i] = cooldown_duration * 1.25;
-					continue;
-				}
-
-				const std::vector<i32>& profit_list = sorted_flips[i].profits();
-
-				// only consider the last few flips done with the item
-				// this should help a little bit with cases where the item has been flipped
-				// for ages and the profitability has gone down over time
-				constexpr u8 flips_to_consider = 15;
-
-				const u8 divisor = profit_list.size() >= flips_to_consider ? flips_to_consider : profit_list.size();
-				const i64 profit = profit_list.at(profit_list.size() - (i % divisor) - 1);
-
-				total_profit += profit;
-				buy_limit_cooldowns[i] = cooldown_duration;
-				flipped_item_count++;
-			}
-			assert(flipped_item_count != 0);
+		stats.push_back(stat);
+		ranking.push_back(settings.top_flip_count - 1 - i);
+	}
 
-			// reduce the cooldown of all flips by one hour
-			for (u8& cooldown : buy_limit_cooldowns)
-			{
-				if (cooldown > 0) [[likely]]
-					cooldown--;
-			}
-		}
+	const stats::avg_stat_table flips(stats);
 
-		return total_profit;
-	};
+	SUBCASE("Fresh random numbers for each seed")
+	{
+		const f64 reward = reward_function(flips, ranking, settings, 42);
+		CHECK(reward > 0);
+		CHECK(reward_function(flips, ranking, settings, 42) == reward);
+		CHECK(reward_function(flips, ranking, settings, 43) != reward);
+	}
 
-	f64 repetition_total_profit{0};
-	for (size_t sim_rep = 0; sim_rep < simulation_repetitions; ++sim_rep)
-		repetition_total_profit += simulation_run();
+	SUBCASE("Common random numbers")
+	{
+		const simulation_scenarios scenarios(16, 42, settings);
+		CHECK(scenarios.count() == 16);
+		CHECK(scenarios.cancellation_draw(15, settings.hours - 1, settings.top_flip_count - 1) == simulation_scenarios(16, 42, settings).cancellation_draw(15, settings.hours - 1, settings.top_flip_count - 1));
 
-	return repetition_total_profit / simulation_repetitions;
+		const f64 reward = reward_function(flips, ranking, settings, scenarios);
+		CHECK(reward > 0);
+		CHECK(reward_function(flips, ranking, settings, scenarios) == reward);
+
+		/* A better ranking is better on the same scenarios */
+		std::reverse(ranking.begin(), ranking.end());
+		CHECK(reward_function(flips, ranking, settings, scenarios) < reward);
+	}
 }
@@ -1,19 +1,164 @@
 #include "Random.hpp"
 
+#include <algorithm>
 #include <ctime>
+#include <doctest/doctest.h>
+#include <sstream>
+#include <vector>
+
+/* Written in front of the saved state, so that states of other engines aren't mixed up with it */
+constexpr char state_prefix[] = "xoshiro256**";
 
 random::random()
 {
 	unsigned int seed = time(0);
-	rng_engine.seed(seed);
+	this->seed(seed);
+}
+
+void random::seed(u64 seed)
+{
+	/* Expand the seed with splitmix64. The outputs of consecutive
+	 * streams are never all zero, which would be a stuck state */
+	for (u64 i = 0; i < engine_state.size(); ++i)
+		engine_state[i] = stream_seed(seed, i);
+}
+
+u64 random::stream_seed(u64 seed, u64 stream)
+{
+	/* splitmix64 */
+	u64 z = seed + (stream + 1) * 0x9e3779b97f4a7c15;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+void random::jump()
+{
+	constexpr std::array<u64, 4> jump_polynomial = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+
+	std::array<u64, 4> jumped{0};
+	for (const u64 word : jump_polynomial)
+	{
+		for (u8 bit = 0; bit < 64; ++bit)
+		{
+			if (word & (u64{1} << bit))
+			{
+				for (u8 i = 0; i < jumped.size(); ++i)
+					jumped[i] ^= engine_state[i];
+			}
+
+			next();
+		}
+	}
+
+	engine_state = jumped;
+}
+
+std::string random::state() const
+{
+	std::stringstream stream;
+	stream << state_prefix;
+	for (const u64 word : engine_state)
+		stream << ' ' << word;
+
+	return stream.str();
+}
+
+bool random::set_state(const std::string& state)
+{
+	std::stringstream stream(state);
+	std::string prefix;
+	std::array<u64, 4> words;
+
+	stream >> prefix;
+	for (u64& word : words)
+		stream >> word;
+
+	if (stream.fail() || prefix != state_prefix)
+		return false;
+
+	/* The engine would only ever return zeroes */
+	if (std::all_of(words.begin(), words.end(), [](const u64 word) { return word == 0; }))
+		return false;
+
+	engine_state = words;
+	return true;
 }
 
-void random::seed(unsigned int seed)
+TEST_CASE("Random number stream state")
 {
-	rng_engine.seed(seed);
+	class random rng;
+	rng.seed(1234);
+	rng.next();
+
+	const std::string state = rng.state();
+	const u64 expected = rng.next();
+
+	class random restored;
+	CHECK(restored.set_state(state));
+	CHECK(restored.next() == expected);
+
+	CHECK_FALSE(restored.set_state("not a state"));
+	CHECK_FALSE(restored.set_state("xoshiro256** 0 0 0 0"));
+	CHECK(random::stream_seed(1, 0) != random::stream_seed(1, 1));
+
+	/* Reference values of xoshiro256** */
+	CHECK(restored.set_state("xoshiro256** 1 2 3 4"));
+	CHECK(restored.next() == 11520);
+	CHECK(restored.next() == 0);
+	CHECK(restored.next() == 1509978240);
 }
 
-unsigned long random::next()
+TEST_CASE("Random number distributions")
 {
-	return rng_engine();
+	class random rng;
+	rng.seed(42);
+
+	SUBCASE("Bounded integers")
+	{
+		std::array<u32, 7> counts{0};
+		for (u32 i = 0; i < 7000; ++i)
+		{
+			const i32 value = rng.range(-3, 3);
+			REQUIRE(value >= -3);
+			REQUIRE(value <= 3);
+			counts[value + 3]++;
+		}
+
+		/* Each value should come up roughly a thousand times */
+		for (const u32 count : counts)
+			CHECK(count > 800);
+
+		CHECK(rng.range<u8>(0, 255) <= 255);
+		CHECK(rng.range(5, 5) == 5);
+		rng.range<u64>(0, UINT64_MAX);
+	}
+
+	SUBCASE("Uniform floats")
+	{
+		class random copy = rng;
+
+		std::vector<f32> values(1000);
+		rng.fill_uniform(std::span<f32>(values));
+
+		for (const f32 value : values)
+		{
+			CHECK(value >= 0.0f);
+			CHECK(value < 1.0f);
+			CHECK(value == copy.range_float(0.0f, 1.0f));
+		}
+
+		std::vector<f64> doubles(1000);
+		rng.fill_uniform(std::span<f64>(doubles));
+		for (const f64 value : doubles)
+			CHECK(value == copy.range_float(0.0, 1.0));
+	}
+
+	SUBCASE("Jumped streams")
+	{
+		class random other = rng;
+		other.jump();
+		CHECK(other.state() != rng.state());
+		CHECK(other.next() != rng.next());
+	}
 }
@@ -1,46 +1,296 @@
 #include "Recommendations.hpp"
 
 #include <cassert>
+#include <doctest/doctest.h>
+#include <filesystem>
 #include <iostream>
+#include <nlohmann/json.hpp>
+#include <numeric>
+#include <unistd.h>
 
-f64 v2_recommendation_algorithm(const stats::avg_stat& stat, const std::array<f64, v2_variable_count>& weights)
+/* The SIMD kernels are picked at runtime, so they are compiled in even if the
+ * rest of the program targets an older CPU */
+#if defined(__x86_64__) || defined(__i386__)
+#define V2_SIMD_DISPATCH
+#include <immintrin.h>
+#endif
+
+bool load_v2_recommendation_weights(const std::string& file_path)
+{
+	if (!std::filesystem::exists(file_path))
+		return false;
+
+	std::array<f64, v2_variable_count> weights;
+
+	try
+	{
+		const nlohmann::json json_data = nlohmann::json::parse(flip_utils::read_file(file_path));
+		const nlohmann::json& saved_weights = json_data.at("weights");
+
+		if (saved_weights.size() != v2_variable_count)
+			throw std::runtime_error("wrong amount of weights");
+
+		for (u8 i = 0; i < v2_variable_count; ++i)
+		{
+			weights[i] = saved_weights.at(i).get<f64>();
+			if (!std::isfinite(weights[i]) || weights[i] < 0)
+				throw std::runtime_error("invalid weight value");
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Ignoring the v2 weights in " << file_path << ": " << e.what() << '\n';
+		return false;
+	}
+
+	v2_recommendation_algorithm_weights = weights;
+	return true;
+}
+
+void save_v2_recommendation_weights(const std::array<f64, v2_variable_count>& weights, const std::string& file_path)
+{
+	nlohmann::json json_data;
+	json_data["weights"] = weights;
+
+	if (!flip_utils::write_file_durable(file_path, json_data.dump(4) + '\n'))
+		std::cout << "Couldn't write the v2 weights to " << file_path << '\n';
+}
+
+TEST_CASE("Saved v2 weights")
+{
+	const std::string file_path = std::filesystem::temp_directory_path() / ("rs-flip-weights-test-" + std::to_string(getpid()) + ".json");
+	const std::array<f64, v2_variable_count> original_weights = v2_recommendation_algorithm_weights;
+
+	CHECK_FALSE(load_v2_recommendation_weights(file_path));
+
+	const std::array<f64, v2_variable_count> weights = { 0.1, 0.2, 0.05, 0.15, 0.1, 0.2, 0.1, 0.1 };
+	save_v2_recommendation_weights(weights, file_path);
+	CHECK(load_v2_recommendation_weights(file_path));
+	CHECK(v2_recommendation_algorithm_weights == weights);
+
+	flip_utils::write_file_durable(file_path, R"({ "weights": [ 0.5, 0.5 ] })");
+	CHECK_FALSE(load_v2_recommendation_weights(file_path));
+	CHECK(v2_recommendation_algorithm_weights == weights);
+
+	v2_recommendation_algorithm_weights = original_weights;
+	std::filesystem::remove(file_path);
+}
+
+// the item count is padded to the widest SIMD width (8 doubles with AVX-512)
+constexpr size_t feature_matrix_lane_count = 8;
+
+/* Every kernel sums the products in the same order as v2_recommendation_algorithm()
+ * and the multiplications aren't fused with the additions, so all of them give exactly
+ * the same scores */
+static void score_scalar(const f64* variables, const f64* age_penalties, const size_t stride, const f64* weights, f64* scores)
+{
+	std::fill(scores, scores + stride, 0.0);
+
+	for (u8 v = 0; v < v2_variable_count; ++v)
+	{
+		const f64* column = &variables[v * stride];
+		const f64 weight = weights[v];
+
+		for (size_t i = 0; i < stride; ++i)
+			scores[i] += column[i] * weight;
+	}
+
+	for (size_t i = 0; i < stride; ++i)
+		scores[i] *= age_penalties[i];
+}
+
+#ifdef V2_SIMD_DISPATCH
+__attribute__((target("avx2")))
+static void score_avx2(const f64* variables, const f64* age_penalties, const size_t stride, const f64* weights, f64* scores)
+{
+	for (size_t i = 0; i < stride; i += 4)
+	{
+		__m256d sum = _mm256_setzero_pd();
+		for (u8 v = 0; v < v2_variable_count; ++v)
+			sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_loadu_pd(&variables[v * stride + i]), _mm256_set1_pd(weights[v])));
+
+		_mm256_storeu_pd(&scores[i], _mm256_mul_pd(sum, _mm256_loadu_pd(&age_penalties[i])));
+	}
+}
+
+__attribute__((target("avx512f")))
+static void score_avx512(const f64* variables, const f64* age_penalties, const size_t stride, const f64* weights, f64* scores)
+{
+	for (size_t i = 0; i < stride; i += 8)
+	{
+		__m512d sum = _mm512_setzero_pd();
+		for (u8 v = 0; v < v2_variable_count; ++v)
+			sum = _mm512_add_pd(sum, _mm512_mul_pd(_mm512_loadu_pd(&variables[v * stride + i]), _mm512_set1_pd(weights[v])));
+
+		_mm512_storeu_pd(&scores[i], _mm512_mul_pd(sum, _mm512_loadu_pd(&age_penalties[i])));
+	}
+}
+#endif
+
+bool v2_feature_matrix::is_supported(const instruction_set set)
+{
+	switch (set)
+	{
+		case instruction_set::scalar:
+			return true;
+
+#ifdef V2_SIMD_DISPATCH
+		case instruction_set::avx2:
+			return __builtin_cpu_supports("avx2");
+
+		case instruction_set::avx512:
+			return __builtin_cpu_supports("avx512f");
+#endif
+
+		default:
+			return false;
+	}
+}
+
+v2_feature_matrix::instruction_set v2_feature_matrix::best_instruction_set()
+{
+	/* The CPU doesn't change while the program is running */
+	static const instruction_set best = []
+	{
+		if (is_supported(instruction_set::avx512))
+			return instruction_set::avx512;
+
+		if (is_supported(instruction_set::avx2))
+			return instruction_set::avx2;
+
+		return instruction_set::scalar;
+	}();
+
+	return best;
+}
+
+std::string v2_feature_matrix::instruction_set_name(const instruction_set set)
+{
+	switch (set)
+	{
+		case instruction_set::scalar:	return "scalar";
+		case instruction_set::avx2:		return "AVX2";
+		case instruction_set::avx512:	return "AVX-512";
+	}
+
+	return "unknown";
+}
+
+v2_feature_matrix::v2_feature_matrix(const stats::avg_stat_table& stats, const stats::scoring_context& context)
+:items(stats.size())
+{
+	stride = (items + feature_matrix_lane_count - 1) / feature_matrix_lane_count * feature_matrix_lane_count;
+	variables.resize(stride * v2_variable_count);
+	age_penalties.resize(stride);
+
+	for (size_t i = 0; i < items; ++i)
+	{
+		const std::array<f64, v2_variable_count> item_variables = v2_recommendation_variables(stats[i], context);
+		for (u8 v = 0; v < v2_variable_count; ++v)
+			variables[v * stride + i] = item_variables[v];
+
+		age_penalties[i] = v2_flip_age_penalty(stats[i], context);
+	}
+}
+
+void v2_feature_matrix::score(const std::array<f64, v2_variable_count>& weights, std::vector<f64>& scores) const
+{
+	score(weights, scores, best_instruction_set());
+}
+
+void v2_feature_matrix::score(const std::array<f64, v2_variable_count>& weights, std::vector<f64>& scores, const instruction_set set) const
+{
+	assert(is_supported(set));
+
+	scores.resize(stride);
+
+	switch (set)
+	{
+#ifdef V2_SIMD_DISPATCH
+		case instruction_set::avx512:
+			score_avx512(variables.data(), age_penalties.data(), stride, weights.data(), scores.data());
+			break;
+
+		case instruction_set::avx2:
+			score_avx2(variables.data(), age_penalties.data(), stride, weights.data(), scores.data());
+			break;
+#endif
+
+		default:
+			score_scalar(variables.data(), age_penalties.data(), stride, weights.data(), scores.data());
+			break;
+	}
+
+	scores.resize(items);
+}
+
+void v2_feature_matrix::rank(const std::array<f64, v2_variable_count>& weights, std::vector<f64>& scores, std::vector<u32>& ranking, const size_t top_count) const
+{
+	score(weights, scores);
+
+	ranking.resize(items);
+	std::iota(ranking.begin(), ranking.end(), 0);
+
+	const auto top_end = ranking.begin() + std::min(top_count, items);
+	std::partial_sort(ranking.begin(), top_end, ranking.end(), [&scores](const u32 a, const u32 b) {
+		return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+	});
+
+	ranking.erase(top_end, ranking.end());
+}
+
+size_t v2_feature_matrix::item_count() const
+{
+	return items;
+}
+
+TEST_CASE("v2 feature matrix")
 {
-	// variables and their weights
-	const f64 variables[v2_variable_count] = {
-		// avg profit
-		stat.normalized_avg_profit(),
+	std::vector<stats::avg_stat> stats;
+	for (i32 i = 0; i < 11; ++i)
+	{
+		stats::avg_stat stat("Item " + std::to_string(i));
+		for (i32 j = 0; j <= i; ++j)
+			stat.add_data((i * 7919 + j * 104729) % 20000 - 5000, (i + j) % 13, 100 + i * j, i * 11 + j);
 
-		// success rate
-		stat.profitable_flip_count() / static_cast<f64>(stat.flip_count()),
+		if (i % 3 == 0)
+			stat.inc_cancel_count();
 
-		// consistency
-		1.0 / (stat.profit_standard_deviation() + 1),
+		stats.push_back(stat);
+	}
 
-		// cancellation penalty
-		1.0 - stat.cancellation_ratio(),
+	stats::scoring_context context(stats);
+	context.weights = { 0.3, 0.05, 0.1, 0.15, 0.05, 0.2, 0.1, 0.05 };
+	const std::array<f64, v2_variable_count> weights = context.weights;
 
-		// how many flips have been done
-		stat.flip_count() >= 15 ? 1.0 : stat.flip_count() / 15.0,
+	const v2_feature_matrix matrix(stats::avg_stat_table(stats), context);
+	CHECK(matrix.item_count() == stats.size());
 
-		// average return on investment
-		stat.normalized_avg_roi(),
+	std::vector<f64> scores;
+	matrix.score(weights, scores);
+	REQUIRE(scores.size() == stats.size());
 
-		// average buy limit
-		stat.normalized_avg_buy_limit(),
+	for (size_t i = 0; i < stats.size(); ++i)
+		CHECK(scores[i] == v2_recommendation_algorithm(stats[i], context));
 
-		// reversed average buy limit
-		1.0 - stat.normalized_avg_buy_limit()
-	};
+	/* Every instruction set gives exactly the same scores */
+	for (const v2_feature_matrix::instruction_set set : { v2_feature_matrix::instruction_set::scalar, v2_feature_matrix::instruction_set::avx2, v2_feature_matrix::instruction_set::avx512 })
+	{
+		if (!v2_feature_matrix::is_supported(set))
+			continue;
 
-	f64 composite_score{0};
-	for (u8 i = 0; i < v2_variable_count; ++i)
-		composite_score += variables[i] * weights[i];
+		std::vector<f64> instruction_set_scores;
+		matrix.score(weights, instruction_set_scores, set);
+		CHECK(instruction_set_scores == scores);
+	}
 
-	assert(composite_score <= static_cast<f64>(v2_variable_count));
+	std::vector<u32> ranking;
+	matrix.rank(weights, scores, ranking, 5);
+	REQUIRE(ranking.size() == 5);
 
-	// lower the score for flips with out-of-date data
-	const f64 flip_age = stat.latest_trade_index() / static_cast<f64>(stat.total_flip_count());
-	const f64 flip_age_penalty = std::clamp(flip_age, 0.90, 1.0);
+	for (size_t i = 1; i < ranking.size(); ++i)
+		CHECK(scores[ranking[i - 1]] >= scores[ranking[i]]);
 
-	return composite_score * flip_age_penalty;
+	const f64 best_score = *std::max_element(scores.begin(), scores.end());
+	CHECK(scores[ranking[0]] == best_score);
 }
@@ -0,0 +1,357 @@
+#include "OpLog.hpp"
+#include "Server.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <doctest/doctest.h>
+#include <filesystem>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+/* Bumped whenever the messages change, so that a client doesn't talk to a server
+ * that was started from another version of the program */
+constexpr u32 protocol_version = 1;
+
+/* Nobody types a command line this long */
+constexpr u32 max_message_size = 1024 * 1024;
+
+/* How often the server checks if it should stop while waiting for clients */
+constexpr int stop_check_interval_ms = 250;
+
+/* Clients are served one at a time, so a client that stops sending or reading
+ * gets dropped after this long instead of blocking everybody else */
+constexpr int client_timeout_seconds = 2;
+
+static std::atomic<bool> stop_requested{false};
+
+static void handle_stop_signal(int)
+{
+	stop_requested = true;
+}
+
+/* Messages are the payload of an op_log record prefixed with its size */
+static bool send_message(const int fd, const op_log::record& message)
+{
+	const u32 size = message.data().size();
+	std::string bytes(reinterpret_cast<const char*>(&size), sizeof(size));
+	bytes.append(message.data());
+
+	size_t sent = 0;
+	while (sent < bytes.size())
+	{
+		// a client that has gone away shouldn't kill the server with SIGPIPE
+		const ssize_t result = send(fd, bytes.data() + sent, bytes.size() - sent, MSG_NOSIGNAL);
+		if (result < 0 && errno == EINTR)
+			continue;
+
+		if (result <= 0)
+			return false;
+
+		sent += result;
+	}
+
+	return true;
+}
+
+static bool receive_bytes(const int fd, char* data, const size_t size)
+{
+	size_t received = 0;
+	while (received < size)
+	{
+		const ssize_t result = recv(fd, data + received, size - received, 0);
+		if (result < 0 && errno == EINTR)
+			continue;
+
+		if (result <= 0)
+			return false;
+
+		received += result;
+	}
+
+	return true;
+}
+
+static bool receive_message(const int fd, std::string& payload)
+{
+	u32 size;
+	if (!receive_bytes(fd, reinterpret_cast<char*>(&size), sizeof(size)) || size > max_message_size)
+		return false;
+
+	payload.resize(size);
+	return receive_bytes(fd, payload.data(), size);
+}
+
+static bool socket_address(const std::string& socket_path, sockaddr_un& address)
+{
+	address = {};
+	address.sun_family = AF_UNIX;
+
+	if (socket_path.size() >= sizeof(address.sun_path))
+		return false;
+
+	std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+	return true;
+}
+
+/* Returns a negative value if there's nobody listening on the socket */
+static int connect_to_server(const std::string& socket_path)
+{
+	sockaddr_un address;
+	if (!socket_address(socket_path, address))
+		return -1;
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool set_timeouts(const int fd)
+{
+	const timeval timeout{client_timeout_seconds, 0};
+	return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0
+		&& setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+/* Run the command sent by the client and send back its output */
+static void handle_client(const int fd, const server::command_handler& handler)
+{
+	if (!set_timeouts(fd))
+		return;
+
+	std::string payload;
+	if (!receive_message(fd, payload))
+		return;
+
+	op_log::record_reader reader(payload);
+	u32 version{};
+	u32 arg_count{};
+	std::vector<std::string> args;
+
+	bool valid = reader.get(version) && version == protocol_version && reader.get(arg_count);
+	for (u32 i = 0; valid && i < arg_count; ++i)
+		valid = reader.get(args.emplace_back());
+
+	server::response response{1, ""};
+
+	if (version != protocol_version)
+	{
+		response.output = "The server was started from another version of rs-flip. Restart it with 'flip serve'\n";
+	}
+	else if (!valid || !reader.at_end())
+	{
+		response.output = "The server received an invalid command\n";
+	}
+	else
+	{
+		// the commands print their results, so capture everything that gets printed
+		std::stringstream output;
+		std::streambuf* const stdout_buffer = std::cout.rdbuf(output.rdbuf());
+
+		try
+		{
+			response.exit_code = handler(args);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "The command failed: " << e.what() << '\n';
+			response.exit_code = 1;
+		}
+
+		std::cout.rdbuf(stdout_buffer);
+		response.output = output.str();
+	}
+
+	op_log::record message;
+	message.put(response.exit_code);
+	message.put(response.output);
+	send_message(fd, message);
+}
+
+namespace server
+{
+	i32 serve(const std::string& socket_path, const command_handler& handler)
+	{
+		if (is_running(socket_path))
+		{
+			std::cout << "A server is already running at " << socket_path << '\n';
+			return 1;
+		}
+
+		sockaddr_un address;
+		if (!socket_address(socket_path, address))
+		{
+			std::cout << "The socket path " << socket_path << " is too long\n";
+			return 1;
+		}
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+		{
+			std::cout << "Couldn't create a socket: " << std::strerror(errno) << '\n';
+			return 1;
+		}
+
+		// the socket of a server that crashed is still there
+		std::filesystem::remove(socket_path);
+
+		// only the user can send commands to the server
+		const mode_t previous_umask = umask(0077);
+		const bool bound = bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+		umask(previous_umask);
+
+		if (!bound || listen(fd, 16) != 0)
+		{
+			std::cout << "Couldn't listen on " << socket_path << ": " << std::strerror(errno) << '\n';
+			close(fd);
+			return 1;
+		}
+
+		stop_requested = false;
+		const auto previous_interrupt_handler = std::signal(SIGINT, handle_stop_signal);
+		const auto previous_terminate_handler = std::signal(SIGTERM, handle_stop_signal);
+
+		std::cout << "Listening on " << socket_path << ", stop with Ctrl-C\n" << std::flush;
+
+		while (!stop_requested)
+		{
+			pollfd listener{fd, POLLIN, 0};
+			if (poll(&listener, 1, stop_check_interval_ms) <= 0)
+				continue;
+
+			const int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (client < 0)
+				continue;
+
+			handle_client(client, handler);
+			close(client);
+		}
+
+		std::signal(SIGINT, previous_interrupt_handler);
+		std::signal(SIGTERM, previous_terminate_handler);
+
+		close(fd);
+		std::filesystem::remove(socket_path);
+
+		return 0;
+	}
+
+	void stop()
+	{
+		stop_requested = true;
+	}
+
+	bool is_running(const std::string& socket_path)
+	{
+		const int fd = connect_to_server(socket_path);
+		if (fd < 0)
+			return false;
+
+		close(fd);
+		return true;
+	}
+
+	std::optional<response> forward(const std::string& socket_path, const std::vector<std::string>& args)
+	{
+		const int fd = connect_to_server(socket_path);
+		if (fd < 0)
+			return std::nullopt;
+
+		op_log::record request;
+		request.put(protocol_version);
+		request.put<u32>(args.size());
+		for (const std::string& arg : args)
+			request.put(arg);
+
+		// the command might've been run already, so it can't be retried locally
+		std::string payload;
+		const bool answered = send_message(fd, request) && receive_message(fd, payload);
+		close(fd);
+
+		response result{1, "Lost the connection to the server. The command might not have been run\n"};
+		if (!answered)
+			return result;
+
+		op_log::record_reader reader(payload);
+		i32 exit_code{};
+		std::string output;
+		if (reader.get(exit_code) && reader.get(output) && reader.at_end())
+			result = { exit_code, output };
+
+		return result;
+	}
+}
+
+TEST_CASE("Command server")
+{
+	const std::string socket_path = std::filesystem::temp_directory_path() / ("rs-flip-server-test-" + std::to_string(getpid()));
+
+	CHECK_FALSE(server::forward(socket_path, { "list" }).has_value());
+	CHECK_FALSE(server::is_running(socket_path));
+
+	std::thread server_thread([&socket_path]
+	{
+		server::serve(socket_path, [](const std::vector<std::string>& args) -> i32
+		{
+			for (const std::string& arg : args)
+				std::cout << arg << ';';
+
+			if (args.empty())
+				throw std::runtime_error("no arguments");
+
+			return args.size();
+		});
+	});
+
+	// wait for the server to start listening
+	std::optional<server::response> response;
+	for (u32 i = 0; i < 200 && !response; ++i)
+	{
+		response = server::forward(socket_path, { "add", "-i", "Iron bar", "-b", "100" });
+		if (!response)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	REQUIRE(response.has_value());
+	CHECK(server::is_running(socket_path));
+	CHECK(response->exit_code == 5);
+	CHECK(response->output == "add;-i;Iron bar;-b;100;");
+
+	/* A client that never sends anything gets dropped and the server keeps going */
+	const int idle_client = connect_to_server(socket_path);
+	CHECK(idle_client >= 0);
+
+	const std::optional<server::response> after_idle = server::forward(socket_path, { "list" });
+	REQUIRE(after_idle.has_value());
+	CHECK(after_idle->exit_code == 1);
+	CHECK(after_idle->output == "list;");
+	close(idle_client);
+
+	/* A failing command doesn't stop the server */
+	const std::optional<server::response> failed = server::forward(socket_path, {});
+	REQUIRE(failed.has_value());
+	CHECK(failed->exit_code == 1);
+	CHECK(failed->output == "The command failed: no arguments\n");
+
+	server::stop();
+	server_thread.join();
+
+	CHECK_FALSE(std::filesystem::exists(socket_path));
+}
@@ -0,0 +1,132 @@
+#include "Random.hpp"
+#include "Simulator.hpp"
+
+#include <array>
+#include <doctest/doctest.h>
+#include <string>
+
+namespace simulator
+{
+	ranked_flips::ranked_flips(const stats::avg_stat_table& flips, const std::vector<u32>& ranking, const config& settings)
+	{
+		assert(settings.top_flip_count <= max_top_flip_count);
+
+		const size_t count = std::min<size_t>(ranking.size(), settings.top_flip_count);
+		cancellation_ratios.reserve(count);
+		profits.reserve(count);
+
+		for (size_t rank = 0; rank < count; ++rank)
+		{
+			const stats::avg_stat_table::row flip = flips[ranking[rank]];
+			cancellation_ratios.push_back(flip.cancellation_ratio());
+
+			// only consider the last few flips done with the item
+			// this should help a little bit with cases where the item has been flipped
+			// for ages and the profitability has gone down over time
+			profits.push_back(flip.recent_profit_count() == 0 ? 0 : flip.recent_profit(rank % flip.recent_profit_count()));
+		}
+	}
+
+	u8 ranked_flips::size() const
+	{
+		return profits.size();
+	}
+
+	f64 ranked_flips::cancellation_ratio(const u8 rank) const
+	{
+		return cancellation_ratios[rank];
+	}
+
+	i64 ranked_flips::profit(const u8 rank) const
+	{
+		return profits[rank];
+	}
+
+	/* Counts down the cooldown of every item each hour */
+	static f64 reference_run(const config& settings, const ranked_flips& flips, const std::vector<f32>& draws)
+	{
+		f64 total_profit{0};
+		std::array<u32, max_top_flip_count> cooldowns{0};
+		size_t draw_index{0};
+
+		for (u32 hour = 0; hour < settings.hours; ++hour)
+		{
+			u8 flipped_item_count{0};
+			for (u8 rank = 0; rank < flips.size() && flipped_item_count < settings.slot_count; ++rank)
+			{
+				if (cooldowns[rank] > 0)
+					continue;
+
+				if (draws[draw_index++] < flips.cancellation_ratio(rank))
+				{
+					cooldowns[rank] = settings.cancelled_cooldown;
+					continue;
+				}
+
+				total_profit += flips.profit(rank);
+				cooldowns[rank] = settings.cooldown;
+				flipped_item_count++;
+			}
+
+			for (u32& cooldown : cooldowns)
+			{
+				if (cooldown > 0)
+					cooldown--;
+			}
+		}
+
+		return total_profit;
+	}
+
+	TEST_CASE("Simulator")
+	{
+		std::vector<stats::avg_stat> stats;
+		std::vector<u32> ranking;
+
+		for (u32 i = 0; i < 64; ++i)
+		{
+			stats::avg_stat stat("Item " + std::to_string(i));
+			for (u32 j = 0; j < 1 + i % 6; ++j)
+				stat.add_data(100 * i + j * 31 - 500, 1, 100, i * 6 + j);
+
+			for (u32 j = 0; j < i % 3; ++j)
+				stat.inc_cancel_count();
+
+			stats.push_back(stat);
+			ranking.push_back((i * 23) % 64);
+		}
+
+		const stats::avg_stat_table flips(stats);
+
+		for (const config settings : { config{}, config{ 30, 3, 64, 1, 2 }, config{ 100, 12, 20, 7, 13 } })
+		{
+			const ranked_flips ranked(flips, ranking, settings);
+			CHECK(ranked.size() == settings.top_flip_count);
+
+			/* Draws for each run in the order that they get used */
+			constexpr u8 run_count = 5;
+			class random rng;
+			rng.seed(7);
+
+			std::array<std::vector<f32>, run_count> draws;
+			for (std::vector<f32>& run_draws : draws)
+			{
+				run_draws.resize(static_cast<size_t>(settings.hours) * settings.top_flip_count);
+				rng.fill_uniform(std::span<f32>(run_draws));
+			}
+
+			std::array<size_t, run_count> draw_indices{0};
+			std::array<f64, run_count> profits;
+			run(settings, ranked, std::span<f64>(profits), [&](const size_t r, u32, u8) { return draws[r][draw_indices[r]++]; });
+
+			for (u8 r = 0; r < run_count; ++r)
+				CHECK(profits[r] == reference_run(settings, ranked, draws[r]));
+
+			/* A run gives the same profit on its own */
+			std::array<f64, 1> single_profit;
+			size_t single_draw_index{0};
+			run(settings, ranked, std::span<f64>(single_profit), [&](size_t, u32, u8) { return draws[3][single_draw_index++]; });
+			CHECK(single_profit[0] == profits[3]);
+		}
+	}
+}
@@ -1,8 +1,14 @@
+#include "DB.hpp"
+#include "Flips.hpp"
+#include "Recommendations.hpp"
 #include "Stats.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <doctest/doctest.h>
-#include <execution>
 #include <nlohmann/json.hpp>
+#include <numeric>
 
 namespace stats
 {
@@ -29,37 +35,258 @@ namespace stats
 		CHECK(calc_roi(0, 100) == INFINITY);
 	}
 
-	std::vector<avg_stat> sort_flips_by_roi(std::vector<avg_stat> flips)
+	// a flip and the value it is ordered by
+	struct scored_flip
 	{
-		std::sort(flips.begin(), flips.end(), [](const avg_stat& a, const avg_stat& b) {
-			return a.avg_roi() > b.avg_roi();
-		});
+		f64 score;
+		u32 index;
+	};
 
-		return flips;
+	// the better flip comes first. Equal scores are ordered by the index to
+	// keep the order the same between runs
+	__attribute__((hot))
+	static bool is_better(const scored_flip& a, const scored_flip& b)
+	{
+		return a.score > b.score || (a.score == b.score && a.index < b.index);
 	}
 
-	std::vector<avg_stat> sort_flips_by_profit(std::vector<avg_stat> flips)
+	// works with both std::vector<avg_stat> and avg_stat_table
+	template<typename flip_list, typename key_function>
+	static std::vector<scored_flip> score_flips(const flip_list& flips, key_function key)
+	{
+		assert(flips.size() <= UINT32_MAX);
+
+		std::vector<scored_flip> scored(flips.size());
+		for (u32 i = 0; i < flips.size(); ++i)
+		{
+			// items without any finished flips have NaN averages. Rank them
+			// last so that the scores can be compared
+			const f64 score = key(flips[i]);
+			scored[i] = { std::isnan(score) ? -INFINITY : score, i };
+		}
+
+		return scored;
+	}
+
+	template<typename flip_list, typename key_function>
+	static std::vector<u32> rank_flips(const flip_list& flips, const size_t count, key_function key)
+	{
+		std::vector<scored_flip> scored = score_flips(flips, key);
+
+		const size_t ranked_count = std::min(count, scored.size());
+		std::partial_sort(scored.begin(), scored.begin() + ranked_count, scored.end(), is_better);
+
+		std::vector<u32> ranking(ranked_count);
+		for (size_t i = 0; i < ranked_count; ++i)
+			ranking[i] = scored[i].index;
+
+		return ranking;
+	}
+
+	// copy the flips into the order of the ranking
+	static std::vector<avg_stat> permute_flips(std::vector<avg_stat>& flips, const std::vector<u32>& ranking)
+	{
+		std::vector<avg_stat> sorted;
+		sorted.reserve(ranking.size());
+
+		for (const u32 index : ranking)
+			sorted.push_back(std::move(flips[index]));
+
+		return sorted;
+	}
+
+	std::vector<u32> rank_flips_by_roi(const std::vector<avg_stat>& flips, const size_t count)
+	{
+		return rank_flips(flips, count, [](const avg_stat& flip) { return flip.avg_roi(); });
+	}
+
+	std::vector<u32> rank_flips_by_profit(const std::vector<avg_stat>& flips, const size_t count)
+	{
+		return rank_flips(flips, count, [](const avg_stat& flip) { return flip.avg_profit(); });
+	}
+
+	std::vector<u32> rank_flips_by_recommendation(const std::vector<avg_stat>& flips, const scoring_context& context, const size_t count)
 	{
-		std::sort(flips.begin(), flips.end(), [](const avg_stat& a, const avg_stat& b) {
-			return a.avg_profit() > b.avg_profit();
+		/* The algorithm is picked once for the whole ranking */
+		return with_recommendation_algorithm(context, [&](auto algorithm) {
+			return rank_flips(flips, count, [&context](const avg_stat& flip) { return decltype(algorithm)::score(flip, context); });
 		});
+	}
 
-		return flips;
+	std::vector<u32> rank_flips_by_roi(const avg_stat_table& flips, const size_t count)
+	{
+		return rank_flips(flips, count, [](const avg_stat_table::row& flip) { return flip.avg_roi(); });
 	}
 
-	std::vector<avg_stat> sort_flips_by_recommendation(std::vector<avg_stat> flips)
+	std::vector<u32> rank_flips_by_profit(const avg_stat_table& flips, const size_t count)
 	{
-		std::sort(std::execution::par_unseq, flips.begin(), flips.end(), [](const avg_stat& a, const avg_stat& b) {
-			return a.flip_recommendation() > b.flip_recommendation();
+		return rank_flips(flips, count, [](const avg_stat_table::row& flip) { return flip.avg_profit(); });
+	}
+
+	std::vector<u32> rank_flips_by_recommendation(const avg_stat_table& flips, const scoring_context& context, const size_t count)
+	{
+		return with_recommendation_algorithm(context, [&](auto algorithm) {
+			return rank_flips(flips, count, [&context](const avg_stat_table::row& flip) { return decltype(algorithm)::score(flip, context); });
 		});
+	}
+
+	std::vector<avg_stat> sort_flips_by_roi(std::vector<avg_stat> flips)
+	{
+		return permute_flips(flips, rank_flips_by_roi(flips));
+	}
+
+	std::vector<avg_stat> sort_flips_by_profit(std::vector<avg_stat> flips)
+	{
+		return permute_flips(flips, rank_flips_by_profit(flips));
+	}
+
+	std::vector<avg_stat> sort_flips_by_recommendation(std::vector<avg_stat> flips, const scoring_context& context)
+	{
+		return permute_flips(flips, rank_flips_by_recommendation(flips, context));
+	}
 
-		return flips;
+	void sort_flips_by_recommendation_direct(std::vector<avg_stat>& flips, const scoring_context& context)
+	{
+		flips = permute_flips(flips, rank_flips_by_recommendation(flips, context));
 	}
 
-	void sort_flips_by_recommendation_direct(std::vector<avg_stat>& flips)
+	TEST_CASE("Rank flips")
 	{
-		std::sort(std::execution::par_unseq, flips.begin(), flips.end(), [](const avg_stat& a, const avg_stat& b) {
-			return a.flip_recommendation() > b.flip_recommendation();
+		std::vector<avg_stat> flips;
+		for (i32 i = 0; i < 30; ++i)
+		{
+			avg_stat flip("Item " + std::to_string(i));
+			for (i32 j = 0; j <= i % 5; ++j)
+				flip.add_data((i * 7919 + j * 104729) % 20000 - 5000, (i * 3 + j) % 17, 100 + (i * 31) % 500, i * 5 + j);
+
+			flips.push_back(flip);
+		}
+
+		flips.push_back(flips[4]);
+		const scoring_context context(flips);
+
+		const std::vector<u32> by_roi = rank_flips_by_roi(flips);
+		REQUIRE(by_roi.size() == flips.size());
+		for (size_t i = 1; i < by_roi.size(); ++i)
+		{
+			CHECK(flips[by_roi[i - 1]].avg_roi() >= flips[by_roi[i]].avg_roi());
+			if (flips[by_roi[i - 1]].avg_roi() == flips[by_roi[i]].avg_roi())
+				CHECK(by_roi[i - 1] < by_roi[i]);
+		}
+
+		/* The top of the ranking is the same no matter how much of it is asked for */
+		const std::vector<u32> by_profit = rank_flips_by_profit(flips);
+		const std::vector<u32> top_profit = rank_flips_by_profit(flips, 7);
+		REQUIRE(top_profit.size() == 7);
+		CHECK(std::equal(top_profit.begin(), top_profit.end(), by_profit.begin()));
+		CHECK(rank_flips_by_profit(flips, 100).size() == flips.size());
+
+		const std::vector<avg_stat> sorted = sort_flips_by_recommendation(flips, context);
+		const std::vector<u32> by_recommendation = rank_flips_by_recommendation(flips, context);
+		REQUIRE(sorted.size() == flips.size());
+		for (size_t i = 0; i < sorted.size(); ++i)
+			CHECK(sorted[i].name == flips[by_recommendation[i]].name);
+
+		/* The table gives the same rankings */
+		const avg_stat_table table(flips);
+		CHECK(rank_flips_by_roi(table) == by_roi);
+		CHECK(rank_flips_by_profit(table, 7) == top_profit);
+		CHECK(rank_flips_by_recommendation(table, context) == by_recommendation);
+
+		std::vector<avg_stat> direct = flips;
+		sort_flips_by_recommendation_direct(direct, context);
+		for (size_t i = 0; i < direct.size(); ++i)
+			CHECK(direct[i].name == sorted[i].name);
+	}
+
+	top_flips select_top_flips_by_recommendation(const avg_stat_table& flips, const scoring_context& context, const size_t count, const std::function<bool(const avg_stat_table::row&)>& accept)
+	{
+		const std::vector<scored_flip> scored = with_recommendation_algorithm(context, [&](auto algorithm) {
+			return score_flips(flips, [&context](const avg_stat_table::row& flip) { return decltype(algorithm)::score(flip, context); });
 		});
+
+		// the heap puts the "largest" element first, so the better flip is the smaller one
+		const auto is_worse = [&scored](const u32 a, const u32 b) -> bool
+		{
+			return is_better(scored[b], scored[a]);
+		};
+
+		std::vector<u32> heap(flips.size());
+		std::iota(heap.begin(), heap.end(), 0);
+		std::make_heap(heap.begin(), heap.end(), is_worse);
+
+		top_flips result;
+		while (!heap.empty() && result.accepted.size() < count)
+		{
+			std::pop_heap(heap.begin(), heap.end(), is_worse);
+			const u32 index = heap.back();
+			heap.pop_back();
+
+			result.ranked.push_back(index);
+			if (accept(flips[index]))
+				result.accepted.push_back(index);
+		}
+
+		return result;
+	}
+
+	TEST_CASE("Select the top recommendations")
+	{
+		std::vector<avg_stat> flips;
+		for (i32 i = 0; i < 40; ++i)
+		{
+			avg_stat flip("Item " + std::to_string(i));
+			for (i32 j = 0; j <= i % 7; ++j)
+				flip.add_data((i * 7919 + j * 104729) % 20000 - 5000, (i + j) % 13, 100 + (i * 31) % 500, i * 8 + j);
+
+			flips.push_back(flip);
+		}
+
+		/* Duplicates to get some equal scores */
+		flips.push_back(flips[3]);
+		flips.push_back(flips[10]);
+
+		const scoring_context context(flips);
+		const avg_stat_table table(flips);
+
+		const std::vector<avg_stat> sorted = sort_flips_by_recommendation(flips, context);
+		const auto accept_every_other = [](const auto& flip) { return flip.flip_count() % 2 == 0; };
+
+		for (const size_t count : { 0, 1, 5, 12, 100 })
+		{
+			const top_flips top = select_top_flips_by_recommendation(table, context, count, accept_every_other);
+			CHECK(top.accepted.size() <= count);
+
+			/* Same order as with a full sort */
+			for (size_t i = 0; i < top.ranked.size(); ++i)
+				CHECK(flips[top.ranked[i]].flip_recommendation(context) == sorted[i].flip_recommendation(context));
+
+			/* Everything that was looked at up to the last accepted flip is accounted for */
+			std::vector<u32> expected;
+			for (const u32 index : top.ranked)
+				if (accept_every_other(flips[index]))
+					expected.push_back(index);
+
+			CHECK(top.accepted == expected);
+
+			if (count >= flips.size())
+				CHECK(top.ranked.size() == flips.size());
+		}
+	}
+
+	TEST_CASE("Select recommendations without sold flips")
+	{
+		db db(nlohmann::json{});
+		for (i32 i = 0; i < 12; ++i)
+			db.add_flip(flips::flip("Item " + std::to_string(i % 4), 100, 120, 1000));
+
+		/* Enough flips for flip tips, but none of the items have been sold yet */
+		const avg_stat_table table = db.get_flip_stat_table();
+		CHECK(table.empty());
+
+		const scoring_context context(table);
+		const top_flips top = select_top_flips_by_recommendation(table, context, 10, [](const auto&) { return true; });
+		CHECK(top.ranked.empty());
+		CHECK(top.accepted.empty());
 	}
 }
@@ -0,0 +1,893 @@
+#include "DB.hpp"
+#include "Flips.hpp"
+#include "Margin.hpp"
+#include "Transfer.hpp"
+
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <doctest/doctest.h>
+#include <format>
+#include <iostream>
+#include <limits>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <utility>
+
+/* Only this many problems get printed, the rest are counted */
+constexpr u64 max_reported_problems = 20;
+
+/* The exported text is collected into writes of about this size */
+constexpr size_t output_chunk_size = 1024 * 1024;
+
+namespace transfer
+{
+	/* Columns of the CSV files and keys of the JSON lines */
+	enum class field : u8
+	{
+		item, buy, sell, sold, limit, cancelled, done, account, unknown
+	};
+
+	constexpr std::array<std::string_view, 8> field_names = {
+		"item", "buy", "sell", "sold", "limit", "cancelled", "done", "account"
+	};
+
+	/* Every field besides the account has to be there */
+	constexpr u8 required_fields = 0b0111'1111;
+
+	static field find_field(const std::string_view name)
+	{
+		for (size_t i = 0; i < field_names.size(); ++i)
+		{
+			if (field_names[i] == name)
+				return static_cast<field>(i);
+		}
+
+		return field::unknown;
+	}
+
+	static u8 field_bit(const field key)
+	{
+		return 1 << static_cast<u8>(key);
+	}
+
+	static std::string missing_field_error(const u8 found_fields)
+	{
+		for (size_t i = 0; i < field_names.size(); ++i)
+		{
+			const u8 bit = 1 << i;
+			if ((required_fields & bit) && !(found_fields & bit))
+				return std::format("\"{}\" is missing", field_names[i]);
+		}
+
+		return "";
+	}
+
+	static bool is_number_field(const field key)
+	{
+		return key == field::buy || key == field::sell || key == field::sold || key == field::limit;
+	}
+
+	static bool is_bool_field(const field key)
+	{
+		return key == field::cancelled || key == field::done;
+	}
+
+	static i32& number_field(flips::flip& flip, const field key)
+	{
+		switch (key)
+		{
+			case field::buy:	return flip.buy_price;
+			case field::sell:	return flip.sell_price;
+			case field::sold:	return flip.sold_price;
+			default:			return flip.buylimit;
+		}
+	}
+
+	static bool& bool_field(flips::flip& flip, const field key)
+	{
+		return key == field::cancelled ? flip.cancelled : flip.done;
+	}
+
+	static std::string& string_field(flips::flip& flip, const field key)
+	{
+		return key == field::item ? flip.item : flip.account;
+	}
+
+	/* Clear the flip before parsing the next line into it */
+	static void reset(flips::flip& flip)
+	{
+		flip.item.clear();
+		flip.buy_price = 0;
+		flip.sell_price = 0;
+		flip.sold_price = 0;
+		flip.buylimit = 0;
+		flip.cancelled = false;
+		flip.done = false;
+		flip.account = "main";
+	}
+
+	format format_from_path(const std::string& path)
+	{
+		if (path.ends_with(".jsonl") || path.ends_with(".ndjson"))
+			return format::jsonl;
+
+		return format::csv;
+	}
+
+	line_reader::line_reader(std::istream& input, const size_t chunk_size)
+	:input(input), chunk(chunk_size)
+	{}
+
+	bool line_reader::next(std::string_view& line)
+	{
+		if (partial_line_returned)
+		{
+			partial_line.clear();
+			partial_line_returned = false;
+		}
+
+		while (true)
+		{
+			const char* begin = chunk.data() + position;
+			const size_t length = chunk_end - position;
+			const char* newline = static_cast<const char*>(std::memchr(begin, '\n', length));
+
+			if (newline != nullptr)
+			{
+				const size_t line_length = newline - begin;
+				position += line_length + 1;
+
+				if (partial_line.empty())
+				{
+					line = std::string_view(begin, line_length);
+				}
+				else
+				{
+					partial_line.append(begin, line_length);
+					partial_line_returned = true;
+					line = partial_line;
+				}
+
+				break;
+			}
+
+			// the line continues in the next chunk
+			partial_line.append(begin, length);
+			position = chunk_end;
+
+			if (!input_ended)
+			{
+				input.read(chunk.data(), chunk.size());
+				position = 0;
+				chunk_end = input.gcount();
+				input_ended = chunk_end == 0;
+				continue;
+			}
+
+			// the last line doesn't need to end with a newline
+			if (partial_line.empty())
+				return false;
+
+			partial_line_returned = true;
+			line = partial_line;
+			break;
+		}
+
+		if (line.ends_with('\r'))
+			line.remove_suffix(1);
+
+		return true;
+	}
+
+	/* Validates the parsed flips and adds them to the database */
+	class importer
+	{
+	public:
+		explicit importer(db& database)
+		:database(database)
+		{}
+
+		void add(flips::flip& flip, const u64 line_number)
+		{
+			if (flip.item.empty())
+			{
+				skip(line_number, "the item name is empty");
+				return;
+			}
+
+			const std::vector<std::string> problems = flips::repair(flip);
+			if (!problems.empty())
+				result.cancelled++;
+
+			for (const std::string& problem : problems)
+			{
+				if (report_problem())
+					std::cout << std::format("Warning: line {} [{}] {} -> Marking the flip as cancelled\n", line_number, flip.item, problem);
+			}
+
+			database.import_flip(flip);
+			result.imported++;
+
+			if (flip.done && !flip.cancelled)
+			{
+				flip_count++;
+				total_profit += margin::calc_profit(flip.buy_price, flip.sold_price, flip.buylimit);
+			}
+		}
+
+		void skip(const u64 line_number, const std::string& error)
+		{
+			result.skipped++;
+			if (report_problem())
+				std::cout << std::format("Line {} was skipped: {}\n", line_number, error);
+		}
+
+		/* Count the imported flips into the profit statistics */
+		import_result finish()
+		{
+			if (flip_count > 0)
+			{
+				database.set_stat(db::stat_key::flips_done, database.get_stat(db::stat_key::flips_done) + flip_count);
+				database.set_stat(db::stat_key::profit, database.get_stat(db::stat_key::profit) + total_profit);
+			}
+
+			if (problem_count > max_reported_problems)
+				std::cout << "... and " << problem_count - max_reported_problems << " more problems\n";
+
+			return result;
+		}
+
+	private:
+		db& database;
+		import_result result;
+		i64 flip_count{0};
+		i64 total_profit{0};
+		u64 problem_count{0};
+
+		/* Count a problem. Returns true if it should still be printed */
+		bool report_problem()
+		{
+			return problem_count++ < max_reported_problems;
+		}
+	};
+
+	/* Split a CSV line into fields. Quoted fields can have commas in them and
+	 * "" is a quote. The strings in fields are reused between lines, so the
+	 * field count is returned separately. Returns false if the quotes are malformed */
+	static bool split_csv_line(const std::string_view line, std::vector<std::string>& fields, size_t& field_count)
+	{
+		field_count = 0;
+		size_t i = 0;
+
+		while (true)
+		{
+			if (fields.size() <= field_count)
+				fields.emplace_back();
+
+			std::string& text = fields[field_count++];
+			text.clear();
+
+			if (i < line.size() && line[i] == '"')
+			{
+				for (++i; ; ++i)
+				{
+					if (i >= line.size())
+						return false;
+
+					if (line[i] != '"')
+					{
+						text.push_back(line[i]);
+						continue;
+					}
+
+					if (i + 1 < line.size() && line[i + 1] == '"')
+					{
+						text.push_back('"');
+						++i;
+						continue;
+					}
+
+					++i;
+					break;
+				}
+
+				// nothing but the separator can come after the closing quote
+				if (i < line.size() && line[i] != ',')
+					return false;
+			}
+			else
+			{
+				const size_t end = std::min(line.find(',', i), line.size());
+				text.assign(line.substr(i, end - i));
+				i = end;
+			}
+
+			if (i >= line.size())
+				return true;
+
+			// skip the comma
+			++i;
+		}
+	}
+
+	static std::string_view trim_spaces(std::string_view text)
+	{
+		while (!text.empty() && text.front() == ' ')
+			text.remove_prefix(1);
+
+		while (!text.empty() && text.back() == ' ')
+			text.remove_suffix(1);
+
+		return text;
+	}
+
+	/* Parse the text of a CSV field into the flip. Returns false if the text isn't valid for the field */
+	static bool set_field(flips::flip& flip, const field key, const std::string& text)
+	{
+		if (key == field::unknown)
+			return true;
+
+		if (key == field::item || key == field::account)
+		{
+			string_field(flip, key) = text;
+			return true;
+		}
+
+		const std::string_view value = trim_spaces(text);
+
+		if (is_bool_field(key))
+		{
+			if (value == "true" || value == "1")
+				bool_field(flip, key) = true;
+			else if (value == "false" || value == "0")
+				bool_field(flip, key) = false;
+			else
+				return false;
+
+			return true;
+		}
+
+		i32& number = number_field(flip, key);
+		const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+		return error == std::errc() && end == value.data() + value.size() && !value.empty();
+	}
+
+	static std::optional<import_result> import_csv(line_reader& reader, db& db)
+	{
+		importer importer(db);
+
+		std::string_view line;
+		if (!reader.next(line))
+			return importer.finish();
+
+		// spreadsheet programs like to start the file with a byte order mark
+		if (line.starts_with("\xEF\xBB\xBF"))
+			line.remove_prefix(3);
+
+		std::vector<std::string> fields;
+		size_t field_count{0};
+
+		/* The header decides the order of the columns */
+		std::vector<field> columns;
+		u8 found_fields{0};
+
+		if (!split_csv_line(line, fields, field_count))
+		{
+			std::cout << "The CSV header has a malformed quoted field\n";
+			return std::nullopt;
+		}
+
+		for (size_t i = 0; i < field_count; ++i)
+		{
+			const field key = find_field(trim_spaces(fields[i]));
+			if (key != field::unknown && (found_fields & field_bit(key)))
+			{
+				std::cout << "The CSV header has the column \"" << fields[i] << "\" twice\n";
+				return std::nullopt;
+			}
+
+			if (key != field::unknown)
+				found_fields |= field_bit(key);
+
+			columns.push_back(key);
+		}
+
+		if ((found_fields & required_fields) != required_fields)
+		{
+			std::cout << "The CSV header is invalid, " << missing_field_error(found_fields) << '\n'
+				<< "The first line should be: item,buy,sell,sold,limit,cancelled,done,account\n";
+			return std::nullopt;
+		}
+
+		flips::flip flip;
+		u64 line_number{1};
+
+		while (reader.next(line))
+		{
+			line_number++;
+
+			if (line.empty())
+				continue;
+
+			if (!split_csv_line(line, fields, field_count))
+			{
+				importer.skip(line_number, "a quoted field is malformed");
+				continue;
+			}
+
+			if (field_count != columns.size())
+			{
+				importer.skip(line_number, std::format("there are {} columns instead of {}", field_count, columns.size()));
+				continue;
+			}
+
+			reset(flip);
+
+			size_t invalid_column = columns.size();
+			for (size_t i = 0; i < columns.size() && invalid_column == columns.size(); ++i)
+			{
+				if (!set_field(flip, columns[i], fields[i]))
+					invalid_column = i;
+			}
+
+			if (invalid_column != columns.size())
+			{
+				importer.skip(line_number, std::format("\"{}\" isn't a valid {}", fields[invalid_column], field_names[static_cast<u8>(columns[invalid_column])]));
+				continue;
+			}
+
+			importer.add(flip, line_number);
+		}
+
+		return importer.finish();
+	}
+
+	/* Reads a line with a json object into a flip as the parser goes through
+	 * it, without building a json value of the whole object first */
+	class json_record_parser final : public nlohmann::json_sax<nlohmann::json>
+	{
+	public:
+		/* Returns an error message if the line isn't a valid flip */
+		std::optional<std::string> parse(const std::string_view line, flips::flip& flip)
+		{
+			record = &flip;
+			reset(flip);
+			depth = 0;
+			found_fields = 0;
+			current_key = field::unknown;
+			error.clear();
+
+			if (!nlohmann::json::sax_parse(line.data(), line.data() + line.size(), this))
+				return error;
+
+			if ((found_fields & required_fields) != required_fields)
+				return missing_field_error(found_fields);
+
+			return std::nullopt;
+		}
+
+		bool null() override
+		{
+			return value_of_type(false);
+		}
+
+		bool boolean(const bool value) override
+		{
+			if (!value_of_type(is_bool_field(current_key)))
+				return false;
+
+			if (is_bool_field(current_key))
+				bool_field(*record, current_key) = value;
+
+			return true;
+		}
+
+		bool number_integer(const number_integer_t value) override
+		{
+			return number(value);
+		}
+
+		bool number_unsigned(const number_unsigned_t value) override
+		{
+			return number(value);
+		}
+
+		bool number_float(number_float_t, const string_t&) override
+		{
+			return value_of_type(false);
+		}
+
+		bool string(string_t& value) override
+		{
+			const bool is_string_field = current_key == field::item || current_key == field::account;
+			if (!value_of_type(is_string_field))
+				return false;
+
+			if (is_string_field)
+				string_field(*record, current_key) = value;
+
+			return true;
+		}
+
+		bool binary(binary_t&) override
+		{
+			return value_of_type(false);
+		}
+
+		bool start_object(std::size_t) override
+		{
+			if (depth > 0)
+				return fail("nested objects aren't supported");
+
+			depth++;
+			return true;
+		}
+
+		bool key(string_t& name) override
+		{
+			current_key = find_field(name);
+			return true;
+		}
+
+		bool end_object() override
+		{
+			depth--;
+			return true;
+		}
+
+		bool start_array(std::size_t) override
+		{
+			return fail(depth == 0 ? "the line isn't a json object" : "arrays aren't supported");
+		}
+
+		bool end_array() override
+		{
+			return true;
+		}
+
+		bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& e) override
+		{
+			// leave out the "[json.exception.parse_error.101] " in front of the message
+			const std::string_view message = e.what();
+			const size_t start = message.find("] ");
+			return fail(std::string(start == std::string_view::npos ? message : message.substr(start + 2)));
+		}
+
+	private:
+		flips::flip* record = nullptr;
+		u32 depth{0};
+		u8 found_fields{0};
+		field current_key = field::unknown;
+		std::string error;
+
+		bool fail(const std::string& message)
+		{
+			error = message;
+			return false;
+		}
+
+		/* Values of unknown keys are skipped */
+		bool value_of_type(const bool matches_field)
+		{
+			if (depth == 0)
+				return fail("the line isn't a json object");
+
+			if (current_key == field::unknown)
+				return true;
+
+			if (!matches_field)
+				return fail(std::format("\"{}\" has the wrong type", field_names[static_cast<u8>(current_key)]));
+
+			found_fields |= field_bit(current_key);
+			return true;
+		}
+
+		template<typename T>
+		bool number(const T value)
+		{
+			if (!value_of_type(is_number_field(current_key)))
+				return false;
+
+			if (!is_number_field(current_key))
+				return true;
+
+			if (!std::in_range<i32>(value))
+				return fail(std::format("\"{}\" is out of range", field_names[static_cast<u8>(current_key)]));
+
+			number_field(*record, current_key) = static_cast<i32>(value);
+			return true;
+		}
+	};
+
+	static std::optional<import_result> import_jsonl(line_reader& reader, db& db)
+	{
+		importer importer(db);
+		json_record_parser parser;
+		flips::flip flip;
+
+		std::string_view line;
+		u64 line_number{0};
+
+		while (reader.next(line))
+		{
+			line_number++;
+
+			if (line.find_first_not_of(" \t") == std::string_view::npos)
+				continue;
+
+			const std::optional<std::string> error = parser.parse(line, flip);
+			if (error)
+				importer.skip(line_number, *error);
+			else
+				importer.add(flip, line_number);
+		}
+
+		return importer.finish();
+	}
+
+	std::optional<import_result> import_flips(std::istream& input, const format file_format, db& db)
+	{
+		line_reader reader(input);
+
+		switch (file_format)
+		{
+			case format::csv:	return import_csv(reader, db);
+			case format::jsonl:	return import_jsonl(reader, db);
+		}
+
+		return std::nullopt;
+	}
+
+	static void append_number(std::string& buffer, const i64 number)
+	{
+		std::array<char, 24> text;
+		const auto [end, error] = std::to_chars(text.data(), text.data() + text.size(), number);
+		buffer.append(text.data(), end);
+	}
+
+	static void append_csv_text(std::string& buffer, const std::string& text)
+	{
+		if (text.find_first_of(",\"\r\n") == std::string::npos)
+		{
+			buffer.append(text);
+			return;
+		}
+
+		buffer.push_back('"');
+		for (const char c : text)
+		{
+			if (c == '"')
+				buffer.push_back('"');
+
+			buffer.push_back(c);
+		}
+		buffer.push_back('"');
+	}
+
+	static void append_json_text(std::string& buffer, const std::string& text)
+	{
+		buffer.push_back('"');
+		for (const char c : text)
+		{
+			switch (c)
+			{
+				case '"':	buffer.append("\\\""); break;
+				case '\\':	buffer.append("\\\\"); break;
+				case '\n':	buffer.append("\\n"); break;
+				case '\r':	buffer.append("\\r"); break;
+				case '\t':	buffer.append("\\t"); break;
+				default:
+					if (static_cast<u8>(c) < 0x20)
+						buffer.append(std::format("\\u{:04x}", static_cast<u8>(c)));
+					else
+						buffer.push_back(c);
+					break;
+			}
+		}
+		buffer.push_back('"');
+	}
+
+	static void append_csv_flip(std::string& buffer, const db& db, const u32 index)
+	{
+		append_csv_text(buffer, db.get_flip<db::flip_key::item>(index));
+		buffer.push_back(',');
+		append_number(buffer, db.get_flip<db::flip_key::buy>(index));
+		buffer.push_back(',');
+		append_number(buffer, db.get_flip<db::flip_key::sell>(index));
+		buffer.push_back(',');
+		append_number(buffer, db.get_flip<db::flip_key::sold>(index));
+		buffer.push_back(',');
+		append_number(buffer, db.get_flip<db::flip_key::limit>(index));
+		buffer.append(db.get_flip<db::flip_key::cancelled>(index) ? ",true," : ",false,");
+		buffer.append(db.get_flip<db::flip_key::done>(index) ? "true," : "false,");
+		append_csv_text(buffer, db.get_flip<db::flip_key::account>(index));
+		buffer.push_back('\n');
+	}
+
+	static void append_json_flip(std::string& buffer, const db& db, const u32 index)
+	{
+		buffer.append("{\"item\":");
+		append_json_text(buffer, db.get_flip<db::flip_key::item>(index));
+		buffer.append(",\"buy\":");
+		append_number(buffer, db.get_flip<db::flip_key::buy>(index));
+		buffer.append(",\"sell\":");
+		append_number(buffer, db.get_flip<db::flip_key::sell>(index));
+		buffer.append(",\"sold\":");
+		append_number(buffer, db.get_flip<db::flip_key::sold>(index));
+		buffer.append(",\"limit\":");
+		append_number(buffer, db.get_flip<db::flip_key::limit>(index));
+		buffer.append(db.get_flip<db::flip_key::cancelled>(index) ? ",\"cancelled\":true" : ",\"cancelled\":false");
+		buffer.append(db.get_flip<db::flip_key::done>(index) ? ",\"done\":true" : ",\"done\":false");
+		buffer.append(",\"account\":");
+		append_json_text(buffer, db.get_flip<db::flip_key::account>(index));
+		buffer.append("}\n");
+	}
+
+	void export_flips(const db& db, const format file_format, std::ostream& output)
+	{
+		std::string buffer;
+
+		if (file_format == format::csv)
+			buffer.append("item,buy,sell,sold,limit,cancelled,done,account\n");
+
+		for (u32 i = 0; i < db.total_flip_count(); ++i)
+		{
+			if (file_format == format::csv)
+				append_csv_flip(buffer, db, i);
+			else
+				append_json_flip(buffer, db, i);
+
+			if (buffer.size() >= output_chunk_size)
+			{
+				output.write(buffer.data(), buffer.size());
+				buffer.clear();
+			}
+		}
+
+		output.write(buffer.data(), buffer.size());
+		output.flush();
+	}
+
+	TEST_CASE("Read lines in chunks")
+	{
+		std::stringstream input("first\nsecond line\r\n\nthe last line has no newline");
+		line_reader reader(input, 4);
+
+		std::vector<std::string> lines;
+		std::string_view line;
+		while (reader.next(line))
+			lines.emplace_back(line);
+
+		CHECK(lines == std::vector<std::string>{ "first", "second line", "", "the last line has no newline" });
+		CHECK_FALSE(reader.next(line));
+
+		std::stringstream empty_input;
+		line_reader empty_reader(empty_input);
+		CHECK_FALSE(empty_reader.next(line));
+	}
+
+	TEST_CASE("Import and export flips")
+	{
+		const auto check_same_flips = [](const db& a, const db& b)
+		{
+			REQUIRE(a.total_flip_count() == b.total_flip_count());
+			for (u32 i = 0; i < a.total_flip_count(); ++i)
+				CHECK(a.get_flip_obj(i).to_json() == b.get_flip_obj(i).to_json());
+
+			CHECK(a.get_stat(db::stat_key::flips_done) == b.get_stat(db::stat_key::flips_done));
+			CHECK(a.get_stat(db::stat_key::profit) == b.get_stat(db::stat_key::profit));
+		};
+
+		std::stringstream csv(
+			"\xEF\xBB\xBFitem,buy,sell,sold,limit,cancelled,done,account\n"
+			"Iron bar,100,120,125,1000,false,true,main\n"
+			"\"Dragon bones, noted\",2000,2100,0,50,0,0,alt\n"
+			"\"Rune \"\"platebody\"\"\",37000,38000,38000,70,false,true,\n"
+			"Steel bar,100,120,125,0,false,true,main\n"
+			"Coal,abc,1,1,1,false,false,main\n"
+			"Coal,1,1,1,1,false\n"
+			"\"Coal,1,1,1,1,false,false,main\n"
+			",1,1,1,1,false,false,main\n"
+		);
+
+		db imported(nlohmann::json{});
+		const std::optional<import_result> result = import_flips(csv, format::csv, imported);
+		REQUIRE(result.has_value());
+		CHECK(result->imported == 4);
+		CHECK(result->cancelled == 1);
+		CHECK(result->skipped == 4);
+
+		REQUIRE(imported.total_flip_count() == 4);
+		CHECK(imported.get_flip<db::flip_key::item>(1) == "Dragon bones, noted");
+		CHECK(imported.get_flip<db::flip_key::account>(1) == "alt");
+		CHECK(imported.get_flip<db::flip_key::item>(2) == "Rune \"platebody\"");
+		CHECK(imported.get_flip<db::flip_key::account>(2) == "main");
+		CHECK(imported.open_flip_indices() == std::vector<u32>{ 1 });
+
+		/* The flip with a buy limit of zero is cancelled like flips::fix_stats() would do */
+		CHECK(imported.get_flip<db::flip_key::cancelled>(3));
+		CHECK_FALSE(imported.get_flip<db::flip_key::done>(3));
+
+		CHECK(imported.get_stat(db::stat_key::flips_done) == 2);
+		CHECK(imported.get_stat(db::stat_key::profit) == margin::calc_profit(100, 125, 1000) + margin::calc_profit(37000, 38000, 70));
+
+		/* Repairing the imported flips changes nothing */
+		db repaired(nlohmann::json{});
+		std::stringstream repaired_csv;
+		export_flips(imported, format::csv, repaired_csv);
+		REQUIRE(import_flips(repaired_csv, format::csv, repaired).has_value());
+		flips::fix_stats(repaired);
+		check_same_flips(imported, repaired);
+
+		for (const format file_format : { format::csv, format::jsonl })
+		{
+			std::stringstream exported;
+			export_flips(imported, file_format, exported);
+
+			db round_trip(nlohmann::json{});
+			const std::optional<import_result> round_trip_result = import_flips(exported, file_format, round_trip);
+			REQUIRE(round_trip_result.has_value());
+			CHECK(round_trip_result->imported == 4);
+			CHECK(round_trip_result->skipped == 0);
+			check_same_flips(imported, round_trip);
+
+			std::stringstream exported_again;
+			export_flips(round_trip, file_format, exported_again);
+			CHECK(exported.str() == exported_again.str());
+		}
+
+		/* The columns can be in any order and unknown columns are ignored */
+		std::stringstream reordered("done,note,item,limit,buy,sell,sold,cancelled\ntrue,hello,Iron bar,1000,100,120,125,false\n");
+		db reordered_db(nlohmann::json{});
+		REQUIRE(import_flips(reordered, format::csv, reordered_db).has_value());
+		REQUIRE(reordered_db.total_flip_count() == 1);
+		CHECK(reordered_db.get_flip_obj(0).to_json() == imported.get_flip_obj(0).to_json());
+
+		std::stringstream bad_header("item,buy,sell,limit,cancelled,done\nIron bar,100,120,1000,false,false\n");
+		db bad_header_db(nlohmann::json{});
+		CHECK_FALSE(import_flips(bad_header, format::csv, bad_header_db).has_value());
+		CHECK(bad_header_db.total_flip_count() == 0);
+	}
+
+	TEST_CASE("Import JSON lines")
+	{
+		std::stringstream jsonl(
+			"{\"item\":\"Iron bar\",\"buy\":100,\"sell\":120,\"sold\":125,\"limit\":1000,\"cancelled\":false,\"done\":true,\"note\":\"x\"}\n"
+			"{\"limit\":10,\"item\":\"Gold bar\",\"buy\":300,\"sell\":350,\"sold\":0,\"cancelled\":false,\"done\":false,\"account\":\"alt\",\"comment\":null}\n"
+			"\n"
+			"{\"item\":\"Coal\",\"buy\":\"100\",\"sell\":120,\"sold\":125,\"limit\":1000,\"cancelled\":false,\"done\":true}\n"
+			"{\"item\":\"Coal\",\"buy\":100,\"sell\":120,\"sold\":125,\"limit\":1000,\"cancelled\":false}\n"
+			"{\"item\":\"Coal\",\"buy\":100,\"sell\":120,\"sold\":125,\"limit\":10000000000,\"cancelled\":false,\"done\":true}\n"
+			"{\"item\":\"Coal\",\"buy\":100,\"sell\":120,\"sold\":125,\"limit\":1.5,\"cancelled\":false,\"done\":true}\n"
+			"{\"item\":{\"name\":\"Coal\"},\"buy\":100,\"sell\":120,\"sold\":125,\"limit\":1,\"cancelled\":false,\"done\":true}\n"
+			"{\"item\":\"Coal\",\"buy\":100\n"
+			"[1,2,3]\n"
+			"5\n"
+			"{\"item\":\"Mithril bar\",\"buy\":100,\"sell\":120,\"sold\":0,\"limit\":1000,\"cancelled\":false,\"done\":true}"
+		);
+
+		db imported(nlohmann::json{});
+		const std::optional<import_result> result = import_flips(jsonl, format::jsonl, imported);
+		REQUIRE(result.has_value());
+		CHECK(result->imported == 3);
+		CHECK(result->cancelled == 1);
+		CHECK(result->skipped == 8);
+
+		REQUIRE(imported.total_flip_count() == 3);
+		CHECK(imported.get_flip<db::flip_key::item>(0) == "Iron bar");
+		CHECK(imported.get_flip<db::flip_key::account>(0) == "main");
+		CHECK(imported.get_flip<db::flip_key::limit>(1) == 10);
+		CHECK(imported.get_flip<db::flip_key::account>(1) == "alt");
+		CHECK(imported.open_flip_indices() == std::vector<u32>{ 1 });
+
+		/* A done flip without the sold price gets cancelled */
+		CHECK(imported.get_flip<db::flip_key::cancelled>(2));
+		CHECK(imported.get_stat(db::stat_key::flips_done) == 1);
+
+		CHECK(format_from_path("flips.jsonl") == format::jsonl);
+		CHECK(format_from_path("flips.ndjson") == format::jsonl);
+		CHECK(format_from_path("flips.csv") == format::csv);
+		CHECK(format_from_path("-") == format::csv);
+	}
+}
@@ -155,7 +155,7 @@ TEST_CASE("Misc. flipping unit tests")
 		// and thus the last flip flip_d has an ID of 2
 		constexpr i32 flip_to_cancel = 3;
 
-		flips::cancel(db, flip_to_cancel);
+		CHECK_FALSE(flips::cancel(db, flip_to_cancel));
 
 		// If everything goes right, the program doesn't crash
 		// and all of the flips stay unharmed